@@ -0,0 +1,144 @@
+#include "alpha.h"
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef SDL_HINT_VIDEO_X11_WINDOW_VISUALID
+#define SDL_HINT_VIDEO_X11_WINDOW_VISUALID "SDL_VIDEO_X11_WINDOW_VISUALID"
+#endif
+
+// The circle as a triangle fan out to one pixel inside the edge, opaque, and
+// a strip from there to the edge fading to transparent. Rebuilt when the
+// window size changes.
+static SDL_Vertex vertices[2 * ALPHA_MAX_SEGMENTS + 1];
+static int indices[9 * ALPHA_MAX_SEGMENTS];
+static int n_vertices, n_indices;
+static int geometry_size;
+
+// Pick a 32-bit visual, and only when a compositing manager owns the
+// _NET_WM_CM_Sn selection: without one, transparent pixels show as black
+static int x11_setup(void) {
+    Display *display = XOpenDisplay(NULL);
+    if (!display) {
+        fprintf(stderr, "Cannot open the X display\n");
+        return -1;
+    }
+    int screen = DefaultScreen(display);
+    char name[32];
+    snprintf(name, sizeof(name), "_NET_WM_CM_S%d", screen);
+    int composited = XGetSelectionOwner(display, XInternAtom(display, name, False)) != None;
+    XVisualInfo info;
+    int argb = XMatchVisualInfo(display, screen, 32, TrueColor, &info);
+    XCloseDisplay(display);
+    if (!composited) {
+        fprintf(stderr, "No compositing manager is running\n");
+        return -1;
+    }
+    if (!argb) {
+        fprintf(stderr, "The X server has no 32-bit visual\n");
+        return -1;
+    }
+
+    char id[32];
+    snprintf(id, sizeof(id), "0x%lx", (unsigned long)info.visualid);
+    SDL_SetHint(SDL_HINT_VIDEO_X11_WINDOW_VISUALID, id);
+    SDL_SetHint(SDL_HINT_VIDEO_X11_NET_WM_BYPASS_COMPOSITOR, "0");
+    return 0;
+}
+
+int alpha_window_setup(void) {
+    const char *driver = SDL_GetCurrentVideoDriver();
+    if (!driver) {
+        return -1;
+    }
+    if (strcmp(driver, "x11") == 0) {
+        if (x11_setup() < 0) {
+            return -1;
+        }
+    } else if (strcmp(driver, "wayland") != 0) {
+        // Wayland is always composited
+        fprintf(stderr, "The %s video driver has no transparent windows\n", driver);
+        return -1;
+    }
+    SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 8);
+    return 0;
+}
+
+void alpha_window_cancel(void) {
+    SDL_SetHint(SDL_HINT_VIDEO_X11_WINDOW_VISUALID, "");
+    SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 0);
+}
+
+// The video keeps its color only where the circle left alpha: color =
+// texture * destination alpha, alpha unchanged
+static SDL_BlendMode video_blend(void) {
+    return SDL_ComposeCustomBlendMode(SDL_BLENDFACTOR_DST_ALPHA, SDL_BLENDFACTOR_ZERO, SDL_BLENDOPERATION_ADD,
+                                      SDL_BLENDFACTOR_ZERO, SDL_BLENDFACTOR_ONE, SDL_BLENDOPERATION_ADD);
+}
+
+int alpha_renderer_supported(SDL_Renderer *renderer) {
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(renderer, &info) < 0 || (info.flags & SDL_RENDERER_SOFTWARE)) {
+        return 0;
+    }
+    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, 1, 1);
+    int ok = texture && SDL_SetTextureBlendMode(texture, video_blend()) == 0;
+    if (texture) {
+        SDL_DestroyTexture(texture);
+    }
+    return ok;
+}
+
+// Enough sides that the polygon strays less than a quarter pixel from the
+// circle: the sagitta r (1 - cos(pi / n)) ~ r pi^2 / (2 n^2)
+static void build_geometry(int size) {
+    float center = size / 2.0f;
+    float radius = size / 2.0f;
+    int segments = (int)ceilf((float)M_PI * sqrtf(2 * radius));
+    if (segments < ALPHA_MIN_SEGMENTS) segments = ALPHA_MIN_SEGMENTS;
+    if (segments > ALPHA_MAX_SEGMENTS) segments = ALPHA_MAX_SEGMENTS;
+
+    memset(vertices, 0, sizeof(vertices));
+    vertices[0].position = (SDL_FPoint){ center, center };
+    vertices[0].color.a = 255;
+    for (int i = 0; i < segments; i++) {
+        float angle = 2 * (float)M_PI * i / segments;
+        float c = cosf(angle), s = sinf(angle);
+        SDL_Vertex *inner = &vertices[1 + i], *outer = &vertices[1 + segments + i];
+        inner->position = (SDL_FPoint){ center + (radius - 1) * c, center + (radius - 1) * s };
+        inner->color.a = 255;
+        outer->position = (SDL_FPoint){ center + radius * c, center + radius * s };
+    }
+    n_vertices = 1 + 2 * segments;
+
+    n_indices = 0;
+    for (int i = 0; i < segments; i++) {
+        int a = 1 + i, b = 1 + (i + 1) % segments;
+        int *tri = &indices[n_indices];
+        // Fan triangle, then the two triangles of the edge quad
+        tri[0] = 0, tri[1] = a, tri[2] = b;
+        tri[3] = a, tri[4] = a + segments, tri[5] = b + segments;
+        tri[6] = a, tri[7] = b + segments, tri[8] = b;
+        n_indices += 9;
+    }
+    geometry_size = size;
+}
+
+// The circle goes in first as alpha only, over a transparent clear, then the
+// video is multiplied into it
+int alpha_render(SDL_Renderer *renderer, SDL_Texture *texture, int size) {
+    if (size != geometry_size) {
+        build_geometry(size);
+    }
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+    SDL_RenderClear(renderer);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+    if (SDL_RenderGeometry(renderer, NULL, vertices, n_vertices, indices, n_indices) < 0) {
+        return -1;
+    }
+    SDL_SetTextureBlendMode(texture, video_blend());
+    SDL_Rect dst_rect = { 0, 0, size, size };
+    return SDL_RenderCopy(renderer, texture, NULL, &dst_rect);
+}
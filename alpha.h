@@ -0,0 +1,29 @@
+#ifndef ALPHA_H
+#define ALPHA_H
+
+#include <SDL2/SDL.h>
+
+#define ALPHA_MIN_SEGMENTS 32  // Sides of the polygon approximating the circle
+#define ALPHA_MAX_SEGMENTS 256
+
+// -a: instead of an X Shape mask, a transparent (ARGB) window in which the
+// renderer draws the circle with an anti-aliased edge. Resizing only changes
+// the geometry drawn each frame. Needs a compositor.
+
+// Check that the video driver can show transparent windows (Wayland, or X11
+// with a compositing manager and a 32-bit visual) and set the hints that make
+// SDL create one. Call after SDL_Init and before creating the window. Returns
+// -1 with the reason on stderr when it cannot.
+int alpha_window_setup(void);
+
+// Undo alpha_window_setup() before creating a shaped window instead
+void alpha_window_cancel(void);
+
+// Whether `renderer` can draw alpha_render()'s blending
+int alpha_renderer_supported(SDL_Renderer *renderer);
+
+// Draw `texture` into the circle of a size x size window, leaving the rest
+// transparent. Colors come out premultiplied, as compositors expect.
+int alpha_render(SDL_Renderer *renderer, SDL_Texture *texture, int size);
+
+#endif
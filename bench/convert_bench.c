@@ -0,0 +1,176 @@
+// Compare the -S software path with SDL's software renderer doing the same
+// job: scale the square crop of a YUYV frame into a window-sized surface.
+// Every kernel the CPU can run is checked and timed on its own; the frame
+// table uses the one circam would pick, so CIRCAM_CPU=<level> gives the A/B,
+// on one thread and on the converter's thread pool.
+// Usage: ./convert_bench [iterations] [threads]
+#include "../convert.h"
+#include "../cpu.h"
+#include "../shape.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+    int width, height;
+} captures[] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 } };
+
+static const int windows[] = { 240, 480, 720, 960, 1440 };
+
+// A frame with some structure in every channel, so nothing is constant
+static void fill_yuyv(Uint8 *data, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        Uint8 *row = data + (size_t)y * width * 2;
+        for (int x = 0; x < width; x += 2) {
+            row[x * 2] = (Uint8)(16 + (x + y) % 220);
+            row[x * 2 + 1] = (Uint8)(16 + x * 7 % 225);
+            row[x * 2 + 2] = (Uint8)(16 + (x + 1 + y) % 220);
+            row[x * 2 + 3] = (Uint8)(16 + y * 5 % 225);
+        }
+    }
+}
+
+static double elapsed_ms(Uint64 start, int iterations) {
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000 / SDL_GetPerformanceFrequency() / iterations;
+}
+
+// SDL_UpdateTexture + SDL_RenderCopy on a software renderer, as circam does
+// without -S on a machine with no GPU
+static double sdl_ms(const Uint8 *data, int pitch, const SDL_Rect *crop, int size, int iterations) {
+    SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, size, size, 32, SDL_PIXELFORMAT_RGB888);
+    SDL_Renderer *renderer = surface ? SDL_CreateSoftwareRenderer(surface) : NULL;
+    SDL_Texture *texture =
+        renderer ? SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YUY2, SDL_TEXTUREACCESS_STREAMING, crop->w, crop->h)
+                 : NULL;
+    double ms = -1;
+    if (texture) {
+        const Uint8 *origin = data + (size_t)crop->y * pitch + (size_t)crop->x * 2;
+        SDL_Rect dst = { 0, 0, size, size };
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int i = 0; i < iterations; i++) {
+            SDL_UpdateTexture(texture, NULL, origin, pitch);
+            SDL_RenderCopy(renderer, texture, NULL, &dst);
+            SDL_RenderPresent(renderer);
+        }
+        ms = elapsed_ms(start, iterations);
+    } else {
+        fprintf(stderr, "SDL software renderer failed: %s\n", SDL_GetError());
+    }
+    if (texture) SDL_DestroyTexture(texture);
+    if (renderer) SDL_DestroyRenderer(renderer);
+    SDL_FreeSurface(surface);
+    return ms;
+}
+
+static double convert_ms(struct converter *conv, const Uint8 *data, int pitch, const SDL_Rect *crop, Uint32 *pixels,
+                         int size, int iterations) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < iterations; i++) {
+        convert_yuyv(conv, data, pitch, crop, pixels, size * 4, size);
+    }
+    return elapsed_ms(start, iterations);
+}
+
+// The kernel in use must match the portable one on every input
+static int check_kernel(void) {
+    enum { N = 4096 };
+    static Uint8 y[N], u[N], v[N];
+    static Uint32 a[N], b[N];
+    for (int base = 0; base < 256 * 256 * 256; base += N) {
+        for (int i = 0; i < N; i++) {
+            y[i] = (Uint8)(base + i);
+            u[i] = (Uint8)((base + i) >> 8);
+            v[i] = (Uint8)((base + i) >> 16);
+        }
+        convert_row(y, u, v, a, N);
+        convert_row_c(y, u, v, b, N);
+        if (memcmp(a, b, sizeof(a))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static double row_ns(int iterations) {
+    enum { N = 1440 };
+    static Uint8 y[N], u[N], v[N];
+    static Uint32 out[N];
+    for (int i = 0; i < N; i++) {
+        y[i] = (Uint8)i;
+        u[i] = (Uint8)(i * 3);
+        v[i] = (Uint8)(i * 5);
+    }
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < iterations * 1000; i++) {
+        convert_row(y, u, v, out, N);
+    }
+    return elapsed_ms(start, iterations * 1000) * 1e6 / N;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 50;
+    int threads = argc > 2 ? atoi(argv[2]) : 0;
+    if (iterations < 1) {
+        iterations = 1;
+    }
+    if (SDL_Init(0) < 0) {
+        fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    int status = 0;
+    printf("%10s %12s\n", "kernel", "ns/pixel");
+    for (int level = 0; level < CPU_LEVELS; level++) {
+        // Levels without a kernel of their own would repeat the one below
+        if (convert_use(level) != level) {
+            continue;
+        }
+        if (check_kernel() < 0) {
+            fprintf(stderr, "%s kernel does not match the C kernel\n", convert_kernel());
+            status = 1;
+        }
+        printf("%10s %12.3f\n", convert_kernel(), row_ns(iterations));
+    }
+    convert_use(cpu_level());
+    printf("\nframes with the %s kernel\n", convert_kernel());
+
+    struct converter conv, pooled;
+    SDL_zero(conv);
+    SDL_zero(pooled);
+    converter_start(&pooled, threads);
+    printf("%10s %6s %12s %12s %12s %8s\n", "capture", "window", "sdl ms", "1 thread ms", "pool ms", "speedup");
+    for (size_t c = 0; c < SDL_arraysize(captures); c++) {
+        int width = captures[c].width, height = captures[c].height, pitch = width * 2;
+        Uint8 *data = malloc((size_t)pitch * height);
+        if (!data) {
+            perror("malloc");
+            status = 1;
+            break;
+        }
+        fill_yuyv(data, width, height);
+        SDL_Rect crop = { ((width - height) / 2) & ~1, 0, height, height };
+        for (size_t w = 0; w < SDL_arraysize(windows); w++) {
+            int size = windows[w];
+            Uint32 *pixels = malloc((size_t)size * size * 4);
+            if (!pixels) {
+                perror("malloc");
+                status = 1;
+                break;
+            }
+            double sdl = sdl_ms(data, pitch, &crop, size, iterations);
+            double ours = convert_ms(&conv, data, pitch, &crop, pixels, size, iterations);
+            double pool = convert_ms(&pooled, data, pitch, &crop, pixels, size, iterations);
+            double best = pool < ours ? pool : ours;
+            char name[32];
+            snprintf(name, sizeof(name), "%dx%d", width, height);
+            printf("%10s %6d %12.3f %12.3f %12.3f %7.1fx\n", name, size, sdl, ours, pool, sdl > 0 ? sdl / best : 0);
+            free(pixels);
+        }
+        free(data);
+    }
+    converter_free(&conv);
+    converter_free(&pooled);
+
+    SDL_Quit();
+    return status;
+}
@@ -0,0 +1,236 @@
+// Headless benchmark of the whole capture -> present pipeline. Runs
+// `circam --bench` against the synthetic source under SDL's dummy video
+// driver for every combination of capture size, pixel format and window
+// size, and prints the results as JSON, one case per line.
+//
+// Usage: ./pipeline_bench [-d seconds] [-f fps] [-c circam] [--quick]
+//                         [--save file] [--baseline file] [--threshold percent]
+//
+// With --baseline, cases that got slower than the stored results by more
+// than the threshold (default 10%) are listed on stderr and the exit status
+// is 1.
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CASES 64
+#define OUTPUT_SIZE 4096
+
+static const char *formats[] = { "YUYV", "NV12", "MJPG" };
+static const char *sizes[] = { "640x480", "1280x720", "1920x1080", "3840x2160" };
+static const char *quick_sizes[] = { "640x480", "1920x1080" };
+static const int windows[] = { 240, 480, 960 };
+static const int quick_windows[] = { 480 };
+
+struct result {
+    char name[64];
+    double present_fps;
+    double frame_ns; // Sum of the per-stage wall times
+    long peak_rss_kb;
+};
+
+// Value of "key": in a flat JSON object, 0 when missing
+static double json_number(const char *json, const char *key) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+    const char *p = strstr(json, pattern);
+    return p ? atof(p + strlen(pattern)) : 0;
+}
+
+static int json_string(const char *json, const char *key, char *out, size_t size) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\": \"", key);
+    const char *p = strstr(json, pattern);
+    if (!p) {
+        return -1;
+    }
+    p += strlen(pattern);
+    const char *end = strchr(p, '"');
+    if (!end || (size_t)(end - p) >= size) {
+        return -1;
+    }
+    memcpy(out, p, end - p);
+    out[end - p] = 0;
+    return 0;
+}
+
+// Run one case; fills `output` with circam's JSON line and returns its
+// peak RSS in KiB, or -1 on failure
+static long run_case(const char *circam, int seconds, int fps, const char *format, const char *size, int window,
+                     char *output, size_t output_size) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        char duration[16], rate[16], window_size[16];
+        snprintf(duration, sizeof(duration), "%d", seconds);
+        snprintf(rate, sizeof(rate), "%d", fps);
+        snprintf(window_size, sizeof(window_size), "%d", window);
+        setenv("SDL_VIDEODRIVER", "dummy", 0);
+        dup2(fds[1], STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDERR_FILENO);
+        }
+        close(fds[0]);
+        execl(circam, circam, "--bench", duration, "-s", window_size, "-r", size, "-F", format, "-f", rate,
+              "synthetic", (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    size_t used = 0;
+    ssize_t n;
+    while ((n = read(fds[0], output + used, output_size - 1 - used)) > 0) {
+        used += n;
+        if (used == output_size - 1) {
+            break;
+        }
+    }
+    output[used] = 0;
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || !strchr(output, '{')) {
+        return -1;
+    }
+    return usage.ru_maxrss;
+}
+
+static int load_baseline(const char *path, struct result *base, int max) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    char line[OUTPUT_SIZE];
+    int n = 0;
+    while (n < max && fgets(line, sizeof(line), f)) {
+        if (json_string(line, "name", base[n].name, sizeof(base[n].name)) == 0) {
+            base[n].present_fps = json_number(line, "present_fps");
+            base[n].frame_ns = json_number(line, "frame_ns");
+            base[n].peak_rss_kb = (long)json_number(line, "peak_rss_kb");
+            n++;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    const char *circam = "./circam";
+    const char *baseline = NULL, *save = NULL;
+    int seconds = 2, fps = 60, quick = 0;
+    double threshold = 10;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            quick = 1;
+        } else if (i + 1 < argc && strcmp(argv[i], "-d") == 0) {
+            seconds = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-f") == 0) {
+            fps = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-c") == 0) {
+            circam = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--save") == 0) {
+            save = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--baseline") == 0) {
+            baseline = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--threshold") == 0) {
+            threshold = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [-d seconds] [-f fps] [-c circam] [--quick] [--save file] [--baseline file] "
+                    "[--threshold percent]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (seconds <= 0 || fps <= 0) {
+        fprintf(stderr, "Duration and frame rate must be positive\n");
+        return 2;
+    }
+
+    struct result base[MAX_CASES];
+    int n_base = 0;
+    if (baseline && (n_base = load_baseline(baseline, base, MAX_CASES)) < 0) {
+        return 2;
+    }
+    FILE *saved = NULL;
+    if (save && !(saved = fopen(save, "w"))) {
+        perror(save);
+        return 2;
+    }
+
+    const char *const *size_list = quick ? quick_sizes : sizes;
+    int n_sizes = quick ? 2 : 4;
+    const int *window_list = quick ? quick_windows : windows;
+    int n_windows = quick ? 1 : 3;
+    int failures = 0, regressions = 0;
+    for (int f = 0; f < 3; f++) {
+        for (int s = 0; s < n_sizes; s++) {
+            for (int w = 0; w < n_windows; w++) {
+                struct result r;
+                snprintf(r.name, sizeof(r.name), "%s-%s-w%d", formats[f], size_list[s], window_list[w]);
+                char output[OUTPUT_SIZE];
+                r.peak_rss_kb = run_case(circam, seconds, fps, formats[f], size_list[s], window_list[w], output,
+                                         sizeof(output));
+                if (r.peak_rss_kb < 0) {
+                    fprintf(stderr, "%s: circam failed\n", r.name);
+                    failures++;
+                    continue;
+                }
+                r.present_fps = json_number(output, "present_fps");
+                r.frame_ns = json_number(output, "dqbuf_ns") + json_number(output, "upload_ns") +
+                             json_number(output, "render_ns") + json_number(output, "present_ns");
+
+                // circam's own line, with the case and the totals added
+                char *body = strchr(output, '{') + 1;
+                char *end = strrchr(body, '}');
+                if (end) {
+                    *end = 0;
+                }
+                char line[OUTPUT_SIZE + 256];
+                snprintf(line, sizeof(line), "{\"name\": \"%s\", \"format\": \"%s\", \"size\": \"%s\", \"window\": %d, "
+                         "\"frame_ns\": %.0f, \"peak_rss_kb\": %ld, %s}\n", r.name, formats[f], size_list[s],
+                         window_list[w], r.frame_ns, r.peak_rss_kb, body);
+                fputs(line, stdout);
+                fflush(stdout);
+                if (saved) {
+                    fputs(line, saved);
+                }
+
+                for (int b = 0; b < n_base; b++) {
+                    if (strcmp(base[b].name, r.name) != 0) {
+                        continue;
+                    }
+                    double limit = threshold / 100;
+                    if (r.present_fps < base[b].present_fps * (1 - limit) || r.frame_ns > base[b].frame_ns * (1 + limit) ||
+                        r.peak_rss_kb > base[b].peak_rss_kb * (1 + limit)) {
+                        fprintf(stderr, "REGRESSION %s: %.1f fps (was %.1f), %.0f ns/frame (was %.0f), %ld KiB (was %ld)\n",
+                                r.name, r.present_fps, base[b].present_fps, r.frame_ns, base[b].frame_ns,
+                                r.peak_rss_kb, base[b].peak_rss_kb);
+                        regressions++;
+                    }
+                }
+            }
+        }
+    }
+    if (saved) {
+        fclose(saved);
+    }
+    if (failures) {
+        fprintf(stderr, "%d cases failed to run\n", failures);
+    }
+    if (baseline) {
+        fprintf(stderr, "%d regressions against %s (threshold %.0f%%)\n", regressions, baseline, threshold);
+    }
+    return failures || regressions ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+// Compare the span-based circle mask with the original per-pixel loop.
+// Usage: ./shape_bench [iterations]
+#include "../shape.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The original mask generator, kept here as the reference
+static SDL_Surface *create_circular_shape(int size) {
+    SDL_Surface *surface = SDL_CreateRGBSurface(0, size, size, 32, 0xFF0000, 0xFF00, 0xFF, 0xFF000000);
+    if (!surface) {
+        fprintf(stderr, "SDL_CreateRGBSurface failed: %s\n", SDL_GetError());
+        return NULL;
+    }
+    SDL_FillRect(surface, NULL, SDL_MapRGBA(surface->format, 0, 0, 0, 0));
+    int center = size / 2;
+    int radius = center * center;
+    Uint32 white = SDL_MapRGBA(surface->format, 255, 255, 255, 255);
+    Uint32 *pixels = (Uint32 *)surface->pixels;
+    for (int y = 0; y < size; y++) {
+        int dy = y - center;
+        int dy2 = dy * dy;
+        for (int x = 0; x < size; x++) {
+            int dx = x - center;
+            if (dx * dx + dy2 <= radius) {
+                pixels[y * size + x] = white;
+            }
+        }
+    }
+    return surface;
+}
+
+static int same_mask(SDL_Surface *a, SDL_Surface *b) {
+    for (int y = 0; y < a->h; y++) {
+        if (memcmp((Uint8 *)a->pixels + y * a->pitch, (Uint8 *)b->pixels + y * b->pitch, a->w * 4)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static double ms_per_call(SDL_Surface *(*create)(int), int size, int iterations) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < iterations; i++) {
+        SDL_FreeSurface(create(size));
+    }
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000 / SDL_GetPerformanceFrequency() / iterations;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 20;
+    if (iterations < 1) {
+        iterations = 1;
+    }
+    if (SDL_Init(0) < 0) {
+        fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    printf("%6s %12s %12s %8s\n", "size", "loop ms", "spans ms", "speedup");
+    int status = 0;
+    for (int size = 100; size <= 2000; size += size < 500 ? 100 : 250) {
+        SDL_Surface *a = create_circular_shape(size);
+        SDL_Surface *b = shape_create(size);
+        if (!a || !b) {
+            status = 1;
+            break;
+        }
+        if (!same_mask(a, b)) {
+            fprintf(stderr, "mask mismatch at size %d\n", size);
+            status = 1;
+        }
+        SDL_FreeSurface(a);
+        SDL_FreeSurface(b);
+        double loop = ms_per_call(create_circular_shape, size, iterations);
+        double spans = ms_per_call(shape_create, size, iterations);
+        printf("%6d %12.3f %12.3f %7.1fx\n", size, loop, spans, loop / spans);
+    }
+
+    // Scrolling back and forth through the sizes a wheel would visit
+    struct shape_cache cache;
+    SDL_zero(cache);
+    Uint64 start = SDL_GetPerformanceCounter();
+    int lookups = 0;
+    for (int pass = 0; pass < iterations; pass++) {
+        for (int size = 400; size <= 500; size += 10, lookups++) shape_cache_get(&cache, size);
+        for (int size = 500; size >= 400; size -= 10, lookups++) shape_cache_get(&cache, size);
+    }
+    printf("cached wheel scroll 400..500: %.4f ms per size\n",
+           (double)(SDL_GetPerformanceCounter() - start) * 1000 / SDL_GetPerformanceFrequency() / lookups);
+    shape_cache_free(&cache);
+
+    SDL_Quit();
+    return status;
+}
@@ -1,10 +1,21 @@
 #include <SDL2/SDL.h>
 #include <linux/videodev2.h>
-#include <fcntl.h>
+#include "negotiate.h"
+#include "mjpeg.h"
+#include "shape.h"
+#include "stats.h"
+#include "source.h"
+#include "record.h"
+#include "present.h"
+#include "stamp.h"
+#include "convert.h"
+#include "cpu.h"
+#include "alpha.h"
 #include <unistd.h>
-#include <sys/ioctl.h>
-#include <sys/mman.h>
-#include <sys/select.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,14 +26,62 @@
 #define MIN_WINDOW_SIZE 50
 #define SIZE_STEP 10 // Resize step for keyboard and mouse wheel
 #define RESIZE_STABILIZE_MS 100 // Wait for mouse resize to stabilize
+#define RESIZE_PREFETCH 2 // Masks built ahead in the direction the user is resizing
+#define CAPTURE_TIMEOUT_MS 2000 // Warn when the camera stalls this long
+#define LATENCY_REPORT_MS 5000 // Interval for -l latency reports
+#define BENCH_INPUT_MS 37 // --bench -l wheel step interval, off the frame interval so it lands at every phase
+#define ADAPT_STABLE_MS 500 // Window size must hold this long before capture follows it
+#define ADAPT_UP_RATIO 1.1 // Recapture larger when the window exceeds the crop by this factor
+#define ADAPT_DOWN_RATIO 1.5 // Recapture smaller when the crop exceeds the window by this factor
+#define TB_DIRTY 4 // Set in triple_buffer.middle while the slot holds an unread frame
 
-// Structure to hold buffer information
-struct buffer {
-    void *start;
-    size_t length;
+// A frame handed from the capture thread to the renderer
+struct frame {
+    int index; // Source buffer index (MJPEG: decoder output), -1 when the slot is empty
+    const Uint8 *data; // Raw frame data, NULL for decoder outputs
+    Uint32 sequence;
+    Uint64 timestamp; // Capture time in microseconds (CLOCK_MONOTONIC), 0 when unknown
 };
 
-// Global variables for dragging and resizing
+// Lock-free latest-wins triple buffer. The capture thread owns `back`, the
+// renderer owns `front`, and the third slot is swapped through `middle`.
+struct triple_buffer {
+    struct frame slots[3];
+    int back;
+    int front;
+    SDL_atomic_t middle;
+};
+
+// A configured, streaming capture format
+struct stream {
+    struct negotiate_result mode; // What was negotiated
+    struct source_format fmt;     // What the source actually delivers
+    const struct format_info *format;
+    SDL_Rect src_rect;            // Square crop within the frame
+    struct mjpeg_pool *mjpeg;     // Decoder pool for compressed formats, NULL otherwise
+};
+
+// State shared with the capture thread
+struct capture {
+    struct source *source;
+    int wake_fd; // eventfd used to interrupt the wait on shutdown or request a reconfiguration
+    struct negotiate_request nreq;
+    struct stream stream;     // Replaced by the capture thread under stream_lock
+    SDL_mutex *stream_lock;
+    struct triple_buffer tb;
+    SDL_atomic_t running;
+    SDL_atomic_t event_pending; // A frame event is queued and not yet handled
+    SDL_atomic_t window_size;   // Current window size, for MJPEG DCT scaling
+    SDL_atomic_t capture_size;  // Crop size of the current stream
+    SDL_atomic_t reconfigure;   // Window size to renegotiate for, 0 when none
+    struct stats *stats;
+    struct recorder *recorder; // --record, NULL otherwise
+    int drain;                 // Keep only the newest of several ready buffers
+    Uint32 frame_event;
+};
+
+// Global variables for dragging (when the window manager cannot do it for us)
+// and resizing
 static int dragging = 0;
 static int drag_start_x, drag_start_y; // Screen coordinates at drag start
 static int win_start_x, win_start_y;   // Window position at drag start
@@ -30,39 +89,407 @@ static int pending_resize = 0;         // Flag for pending resize
 static int pending_size = 0;           // Requested size for pending resize
 static Uint32 last_resize_time = 0;    // Time of last resize event
 
-// Function to create or update the circular shape
-SDL_Surface *create_circular_shape(int size) {
-    SDL_Surface *surface = SDL_CreateRGBSurface(0, size, size, 32, 0xFF0000, 0xFF00, 0xFF, 0xFF000000);
-    if (!surface) {
-        fprintf(stderr, "SDL_CreateRGBSurface failed: %s\n", SDL_GetError());
+static void tb_init(struct triple_buffer *tb) {
+    for (int i = 0; i < 3; i++) {
+        tb->slots[i].index = -1;
+    }
+    tb->back = 0;
+    SDL_AtomicSet(&tb->middle, 1);
+    tb->front = 2;
+}
+
+// Publish a new frame (capture thread). Returns the frame that is no longer
+// referenced by either side, which the caller must hand back to the driver.
+static struct frame tb_publish(struct triple_buffer *tb, struct frame f) {
+    tb->slots[tb->back] = f;
+    SDL_MemoryBarrierRelease();
+    int prev = SDL_AtomicSet(&tb->middle, tb->back | TB_DIRTY);
+    tb->back = prev & ~TB_DIRTY;
+    struct frame released = tb->slots[tb->back];
+    tb->slots[tb->back].index = -1;
+    return released;
+}
+
+// Take the newest published frame (renderer). Returns NULL if nothing new
+// arrived since the last call; the previous front frame is released to the
+// capture thread once it publishes again.
+static const struct frame *tb_acquire(struct triple_buffer *tb) {
+    if (!(SDL_AtomicGet(&tb->middle) & TB_DIRTY)) {
+        return NULL;
+    }
+    SDL_MemoryBarrierRelease();
+    int prev = SDL_AtomicSet(&tb->middle, tb->front);
+    SDL_MemoryBarrierAcquire();
+    tb->front = prev & ~TB_DIRTY;
+    return &tb->slots[tb->front];
+}
+
+// Publish a frame to the renderer and wake the main loop. Returns the frame
+// it displaced, which the caller must recycle.
+static struct frame publish_frame(struct capture *cap, struct frame f) {
+    struct frame released = tb_publish(&cap->tb, f);
+
+    // Never queue more than one frame event
+    if (SDL_AtomicCAS(&cap->event_pending, 0, 1)) {
+        SDL_Event event;
+        CLEAR(event);
+        event.type = cap->frame_event;
+        if (SDL_PushEvent(&event) < 0) {
+            SDL_AtomicSet(&cap->event_pending, 0);
+        }
+    }
+    return released;
+}
+
+// MJPEG decoder callbacks: the compressed buffer goes straight back to the
+// source, decoded frames go to the renderer in order
+static void mjpeg_input_done(void *ctx, int input) {
+    struct capture *cap = ctx;
+    source_requeue(cap->source, input);
+}
+
+static int mjpeg_output_ready(void *ctx, int output, Uint32 sequence, Uint64 timestamp) {
+    struct capture *cap = ctx;
+    return publish_frame(cap, (struct frame){ .index = output, .sequence = sequence, .timestamp = timestamp }).index;
+}
+
+// Stop streaming and release every buffer of the current stream
+static void stream_stop(struct capture *cap) {
+    mjpeg_destroy(cap->stream.mjpeg);
+    cap->stream.mjpeg = NULL;
+    source_stop(cap->source);
+}
+
+// Start the source in `mode` and set up cropping and decoding for what it
+// delivers. On failure nothing is left allocated.
+static int stream_start(struct capture *cap, const struct negotiate_result *mode) {
+    struct stream *s = &cap->stream;
+    CLEAR(*s);
+    s->mode = *mode;
+    // Raw frames are displayed from the source's buffers, and the frames in
+    // the triple buffer's front and middle slots only go back on the next
+    // publish. With two buffers the driver would have none left to fill.
+    const struct format_info *requested = format_lookup(mode->fourcc);
+    if (requested && !requested->compressed && cap->source->buffers < SOURCE_RAW_MIN_BUFFERS) {
+        fprintf(stderr, "Using %d buffers, the minimum for uncompressed formats\n", SOURCE_RAW_MIN_BUFFERS);
+        cap->source->buffers = SOURCE_RAW_MIN_BUFFERS;
+    }
+    if (source_start(cap->source, mode, &s->fmt) < 0) {
+        return -1;
+    }
+    s->format = format_lookup(s->fmt.fourcc);
+    if (!s->format) {
+        fprintf(stderr, "Source delivers a pixel format circam cannot display\n");
+        source_stop(cap->source);
+        return -1;
+    }
+    Uint32 fourcc = s->fmt.fourcc;
+    fprintf(stderr, "Capturing %c%c%c%c %dx%d", fourcc & 0xFF, (fourcc >> 8) & 0xFF, (fourcc >> 16) & 0xFF,
+            (fourcc >> 24) & 0xFF, s->fmt.width, s->fmt.height);
+    if (mode->interval.numerator) {
+        fprintf(stderr, " at %.4g fps", (double)mode->interval.denominator / mode->interval.numerator);
+    }
+    fprintf(stderr, s->fmt.hardware_crop ? ", cropped by the driver\n" : "\n");
+
+    // Calculate crop rectangle for square (the whole frame when the driver
+    // crops). Only this part of each frame is uploaded, so it stays aligned
+    // to the chroma subsampling.
+    int crop_size = (s->fmt.width < s->fmt.height ? s->fmt.width : s->fmt.height) & ~1;
+    s->src_rect.x = ((s->fmt.width - crop_size) / 2) & ~1;
+    s->src_rect.y = ((s->fmt.height - crop_size) / 2) & ~1;
+    s->src_rect.w = crop_size;
+    s->src_rect.h = crop_size;
+
+    // Compressed formats need decoders
+    if (s->format->compressed) {
+        struct mjpeg_callbacks cb = { mjpeg_input_done, mjpeg_output_ready, cap };
+        s->mjpeg = mjpeg_create(s->fmt.width, s->fmt.height, 0, &cb);
+        if (!s->mjpeg) {
+            fprintf(stderr, "Failed to start MJPEG decoders\n");
+            source_stop(cap->source);
+            return -1;
+        }
+        mjpeg_set_target_size(s->mjpeg, SDL_AtomicGet(&cap->window_size));
+    }
+    SDL_AtomicSet(&cap->capture_size, crop_size);
+    return 0;
+}
+
+static int same_mode(const struct negotiate_result *a, const struct negotiate_result *b) {
+    return a->fourcc == b->fourcc && a->width == b->width && a->height == b->height &&
+           a->interval.numerator == b->interval.numerator && a->interval.denominator == b->interval.denominator;
+}
+
+// Renegotiate for a new window size and restart the stream if the best mode
+// changed. The renderer skips uploads while stream_lock is held and keeps
+// showing its texture until the new stream's first frame arrives.
+static void reconfigure(struct capture *cap, int window_size) {
+    struct negotiate_request req = cap->nreq;
+    req.target_size = window_size;
+    struct negotiate_result mode;
+    source_negotiate(cap->source, &req, &mode);
+    if (same_mode(&mode, &cap->stream.mode)) {
+        return;
+    }
+
+    struct negotiate_result old = cap->stream.mode;
+    SDL_LockMutex(cap->stream_lock);
+    stream_stop(cap);
+    tb_init(&cap->tb);
+    if (stream_start(cap, &mode) < 0) {
+        fprintf(stderr, "Capture reconfiguration failed, restoring previous mode\n");
+        if (stream_start(cap, &old) < 0) {
+            SDL_Event event;
+            CLEAR(event);
+            event.type = SDL_QUIT;
+            SDL_PushEvent(&event);
+            SDL_AtomicSet(&cap->running, 0);
+        }
+    }
+    SDL_UnlockMutex(cap->stream_lock);
+}
+
+// Dequeue one ready buffer, counting and recording it
+static int dequeue_frame(struct capture *cap, struct source_frame *buf) {
+    struct stats_timer timer;
+    stats_begin(cap->stats, &timer);
+    if (source_dequeue(cap->source, buf) < 0) {
+        return -1;
+    }
+    stats_end(cap->stats, STAGE_DQBUF, &timer);
+    stats_captured(cap->stats, buf->sequence);
+    if (cap->recorder) {
+        recorder_frame(cap->recorder, buf);
+    }
+    return 0;
+}
+
+// Capture thread: waits for frames, publishes the newest one (or hands it to
+// the MJPEG decoders) and requeues whatever the renderer no longer needs
+static int capture_thread(void *data) {
+    struct capture *cap = data;
+    while (SDL_AtomicGet(&cap->running)) {
+        int reconfigure_size = SDL_AtomicSet(&cap->reconfigure, 0);
+        if (reconfigure_size) {
+            reconfigure(cap, reconfigure_size);
+            continue;
+        }
+
+        // Wait for a buffer or a wakeup from the main thread
+        struct pollfd pfd[2] = {
+            { .fd = cap->source->fd, .events = POLLIN },
+            { .fd = cap->wake_fd, .events = POLLIN },
+        };
+        int r = poll(pfd, 2, CAPTURE_TIMEOUT_MS);
+        if (r < 0) {
+            if (errno != EINTR) {
+                perror("poll");
+            }
+            continue;
+        }
+        if (r == 0) {
+            fprintf(stderr, "capture timeout\n");
+            continue;
+        }
+        if (pfd[1].revents & POLLIN) {
+            uint64_t value;
+            if (read(cap->wake_fd, &value, sizeof(value)) < 0) {
+                perror("read wakeup");
+            }
+            continue;
+        }
+        if (pfd[0].revents & (POLLERR | POLLHUP)) {
+            // Device gone or stream broken: ask the main loop to exit
+            fprintf(stderr, "Capture device error\n");
+            SDL_Event event;
+            CLEAR(event);
+            event.type = SDL_QUIT;
+            SDL_PushEvent(&event);
+            break;
+        }
+
+        // Dequeue every ready buffer and keep only the newest. After a stall
+        // the backlog is stale; the older buffers go straight back to the
+        // source instead of being decoded or shown one by one.
+        struct source_frame buf, newer;
+        if (dequeue_frame(cap, &buf) < 0) {
+            continue;
+        }
+        Uint32 discarded = 0;
+        while (cap->drain && dequeue_frame(cap, &newer) == 0) {
+            source_requeue(cap->source, buf.index);
+            buf = newer;
+            discarded++;
+        }
+        stats_discarded(cap->stats, discarded);
+
+        // Compressed frames go to the decoders; when they are all busy the
+        // frame is dropped rather than queued behind them
+        struct stream *s = &cap->stream;
+        if (s->mjpeg) {
+            mjpeg_set_target_size(s->mjpeg, SDL_AtomicGet(&cap->window_size));
+            if (buf.bytesused == 0 ||
+                mjpeg_submit(s->mjpeg, buf.index, buf.data, buf.bytesused, buf.sequence, buf.timestamp) < 0) {
+                source_requeue(cap->source, buf.index);
+            }
+            continue;
+        }
+
+        // Publish it and requeue the buffer it replaces
+        struct frame f = { .index = buf.index, .data = buf.data, .sequence = buf.sequence, .timestamp = buf.timestamp };
+        struct frame released = publish_frame(cap, f);
+        if (released.index >= 0) {
+            source_requeue(cap->source, released.index);
+        }
+    }
+    return 0;
+}
+
+// Upload the square crop of a captured frame. `pitch` is the driver's
+// bytesperline; for NV12 the chroma plane follows the luma plane.
+static void upload_crop(SDL_Texture *texture, Uint32 fourcc, const Uint8 *data, int pitch, int height, const SDL_Rect *crop) {
+    if (fourcc == V4L2_PIX_FMT_NV12) {
+        const Uint8 *y_plane = data + (size_t)crop->y * pitch + crop->x;
+        const Uint8 *uv_plane = data + (size_t)height * pitch + (size_t)(crop->y / 2) * pitch + crop->x;
+        SDL_UpdateNVTexture(texture, NULL, y_plane, pitch, uv_plane, pitch);
+    } else {
+        // Packed 4:2:2
+        SDL_UpdateTexture(texture, NULL, data + (size_t)crop->y * pitch + (size_t)crop->x * 2, pitch);
+    }
+}
+
+// Upload a decoded I420 square; the decoder already cropped (and maybe scaled) it
+static void upload_image(SDL_Texture *texture, const struct mjpeg_image *img) {
+    SDL_UpdateYUVTexture(texture, NULL, img->planes[0], img->pitches[0],
+                         img->planes[1], img->pitches[1], img->planes[2], img->pitches[2]);
+}
+
+// --g2g: read the time stamp of the frame about to be presented back from the
+// renderer, or from the window surface with -S. `frame_size` is the side of
+// the square the frame was cropped to. Returns 0 when there is no readable
+// stamp.
+static Uint64 read_stamp(SDL_Renderer *renderer, SDL_Surface *surface, int window_size, int frame_size) {
+    int y = stamp_row_y(window_size, frame_size);
+    Uint32 value;
+    if (surface) {
+        if (y >= surface->h || window_size > surface->w ||
+            stamp_read((const Uint32 *)((const Uint8 *)surface->pixels + (size_t)y * surface->pitch), window_size,
+                       frame_size, &value) < 0) {
+            return 0;
+        }
+        return stamp_time(value, stats_now_us());
+    }
+
+    Uint32 *row = malloc((size_t)window_size * sizeof(*row));
+    if (!row) {
+        return 0;
+    }
+    SDL_Rect rect = { 0, y, window_size, 1 };
+    Uint64 stamp = 0;
+    if (SDL_RenderReadPixels(renderer, &rect, SDL_PIXELFORMAT_ARGB8888, row, window_size * sizeof(*row)) == 0 &&
+        stamp_read(row, window_size, frame_size, &value) == 0) {
+        stamp = stamp_time(value, stats_now_us());
+    }
+    free(row);
+    return stamp;
+}
+
+// -S: convert the frame on screen straight into the window surface. Returns
+// the surface, or NULL when there is nothing to draw right now or the frame
+// could not be converted.
+static SDL_Surface *draw_software(SDL_Window *window, struct capture *cap, struct converter *conv, int size) {
+    if (SDL_TryLockMutex(cap->stream_lock) != 0) {
         return NULL;
     }
-    SDL_FillRect(surface, NULL, SDL_MapRGBA(surface->format, 0, 0, 0, 0));
-    int center = size / 2;
-    int radius = center * center;
-    Uint32 white = SDL_MapRGBA(surface->format, 255, 255, 255, 255);
-    Uint32 *pixels = (Uint32 *)surface->pixels;
-    for (int y = 0; y < size; y++) {
-        int dy = y - center;
-        int dy2 = dy * dy;
-        for (int x = 0; x < size; x++) {
-            int dx = x - center;
-            if (dx * dx + dy2 <= radius) {
-                pixels[y * size + x] = white;
+    // Size the converter could not allocate its tables for. Not retried, so
+    // the failure is reported once, until the window size changes.
+    static int failed_size;
+    const struct frame *frame = &cap->tb.slots[cap->tb.front];
+    SDL_Surface *surface = frame->index >= 0 ? SDL_GetWindowSurface(window) : NULL;
+    if (surface) {
+        if (size > surface->w) size = surface->w;
+        if (size > surface->h) size = surface->h;
+        int converted = -1;
+        if (size != failed_size) {
+            SDL_LockSurface(surface);
+            converted = convert_yuyv(conv, frame->data, cap->stream.fmt.pitch, &cap->stream.src_rect, surface->pixels,
+                                     surface->pitch, size);
+            SDL_UnlockSurface(surface);
+            if (converted < 0) {
+                fprintf(stderr, "Cannot convert frames for a %dx%d window, not drawing them\n", size, size);
+                failed_size = size;
             }
         }
+        if (converted < 0) {
+            surface = NULL;
+        }
     }
+    SDL_UnlockMutex(cap->stream_lock);
     return surface;
 }
 
+// The whole circle is a drag handle. The window manager moves the window
+// itself, without an event round trip per mouse motion. `data` points to the
+// current window size.
+static SDL_HitTestResult hit_test(SDL_Window *window, const SDL_Point *area, void *data) {
+    (void)window;
+    int radius = *(const int *)data / 2;
+    int dx = area->x - radius, dy = area->y - radius;
+    return dx * dx + dy * dy <= radius * radius ? SDL_HITTEST_DRAGGABLE : SDL_HITTEST_NORMAL;
+}
+
+// Resize the window and its shape to `size`. Transparent windows (-a) pass
+// no `shapes`: their circle is drawn.
+static void set_window_size(SDL_Window *window, struct shape_cache *shapes, SDL_WindowShapeMode *mode, int size) {
+    SDL_SetWindowSize(window, size, size);
+    SDL_Surface *shape_surface = shapes ? shape_cache_get(shapes, size) : NULL;
+    if (shape_surface) {
+        SDL_SetWindowShape(window, shape_surface, mode);
+    }
+}
+
+// --bench -l: a wheel step from SDL's timer thread, alternating up and down
+// so the window size holds. Each one resizes, so it reaches the screen.
+static Uint32 inject_wheel(Uint32 interval, void *data) {
+    int *step = data;
+    SDL_Event event;
+    CLEAR(event);
+    event.type = SDL_MOUSEWHEEL;
+    event.wheel.y = *step;
+    event.wheel.direction = SDL_MOUSEWHEEL_NORMAL;
+    *step = -*step;
+    SDL_PushEvent(&event);
+    return interval;
+}
+
+static void report_latency(Uint32 count, Uint32 sum, Uint32 max) {
+    fprintf(stderr, "input-to-present latency: %u events, avg %.1f ms, max %u ms\n", count, (double)sum / count, max);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-t] [-l] [--stats] [--g2g] [--record <file>] [--fast] [--bench <seconds>] [--cpu-features] [-p latency|smooth|vsync] [-b <buffers>] [-S] [-a] [-s <size>] [-r <width>x<height>] [-f <fps>] [-F <fourcc>] <video_device>\n", prog);
+}
+
 int main(int argc, char *argv[]) {
     int window_size = DEFAULT_SIZE;
     char *video_device = NULL;
     int always_on_top = 0;
+    int log_latency = 0;
+    int show_stats = 0;
+    int software = 0;
+    int alpha = 0;
+    int glass = 0;
+    const char *record_path = NULL;
+    int bench_seconds = 0;
+    int source_flags = 0;
+    int buffers = SOURCE_DEFAULT_BUFFERS;
+    enum present_policy present_policy = PRESENT_LATENCY;
+    struct negotiate_request nreq;
+    CLEAR(nreq);
 
     // Parse command-line arguments
-    if (argc < 2 || argc > 5) {
-        fprintf(stderr, "Usage: %s [-t] [-s <size>] <video_device>\n", argv[0]);
+    if (argc < 2) {
+        usage(argv[0]);
         fprintf(stderr, "Example: %s -t -s 256 /dev/video0\n", argv[0]);
         return 1;
     }
@@ -72,6 +499,55 @@ int main(int argc, char *argv[]) {
         if (strcmp(argv[i], "-t") == 0) {
             always_on_top = 1;
             i++;
+        } else if (strcmp(argv[i], "-l") == 0) {
+            log_latency = 1;
+            i++;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = 1;
+            i++;
+        } else if (strcmp(argv[i], "--g2g") == 0) {
+            show_stats = 1;
+            glass = 1;
+            source_flags |= SOURCE_STAMP_TIME;
+            i++;
+        } else if (strcmp(argv[i], "--record") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --record requires a file name\n");
+                return 1;
+            }
+            record_path = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            if (i + 1 >= argc || (bench_seconds = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "Error: --bench requires a number of seconds\n");
+                return 1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--cpu-features") == 0) {
+            cpu_print_features(stdout);
+            printf("convert kernel: %s\n", convert_kernel());
+            return 0;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            if (i + 1 >= argc || present_parse_policy(argv[i + 1], &present_policy) < 0) {
+                fprintf(stderr, "Error: -p requires latency, smooth or vsync\n");
+                return 1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-b") == 0) {
+            if (i + 1 >= argc || (buffers = atoi(argv[i + 1])) < 2 || buffers > SOURCE_MAX_BUFFERS) {
+                fprintf(stderr, "Error: -b requires a buffer count from 2 to %d\n", SOURCE_MAX_BUFFERS);
+                return 1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-S") == 0) {
+            software = 1;
+            i++;
+        } else if (strcmp(argv[i], "-a") == 0) {
+            alpha = 1;
+            i++;
+        } else if (strcmp(argv[i], "--fast") == 0) {
+            source_flags |= SOURCE_REPLAY_FAST;
+            i++;
         } else if (strcmp(argv[i], "-s") == 0) {
             if (i + 1 >= argc) {
                 fprintf(stderr, "Error: -s requires a size value\n");
@@ -83,6 +559,29 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
             i += 2;
+        } else if (strcmp(argv[i], "-r") == 0) {
+            if (i + 1 >= argc || sscanf(argv[i + 1], "%dx%d", &nreq.width, &nreq.height) != 2 ||
+                nreq.width <= 0 || nreq.height <= 0) {
+                fprintf(stderr, "Error: -r requires a resolution such as 1280x720\n");
+                return 1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-f") == 0) {
+            if (i + 1 >= argc || (nreq.fps = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "Error: -f requires a positive frame rate\n");
+                return 1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-F") == 0) {
+            if (i + 1 >= argc || !(nreq.fourcc = parse_fourcc(argv[i + 1]))) {
+                fprintf(stderr, "Error: -F requires a pixel format such as YUYV\n");
+                return 1;
+            }
+            if (!format_lookup(nreq.fourcc)) {
+                fprintf(stderr, "Error: Pixel format %s is not supported\n", argv[i + 1]);
+                return 1;
+            }
+            i += 2;
         } else {
             video_device = argv[i];
             i++;
@@ -91,195 +590,320 @@ int main(int argc, char *argv[]) {
 
     if (!video_device) {
         fprintf(stderr, "Error: No video device specified\n");
-        fprintf(stderr, "Usage: %s [-t] [-s <size>] <video_device>\n", argv[0]);
+        usage(argv[0]);
         return 1;
     }
 
+    // The software path converts YUYV only
+    if (software) {
+        if (nreq.fourcc && nreq.fourcc != V4L2_PIX_FMT_YUYV) {
+            fprintf(stderr, "Error: -S supports YUYV capture only\n");
+            return 1;
+        }
+        nreq.fourcc = V4L2_PIX_FMT_YUYV;
+    }
+
     // Initialize SDL
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    if (SDL_Init(SDL_INIT_VIDEO | (bench_seconds && log_latency ? SDL_INIT_TIMER : 0)) < 0) {
         fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
         return 1;
     }
 
-    // Open V4L2 device
-    int fd = open(video_device, O_RDWR, 0);
-    if (fd < 0) {
-        perror("Cannot open device");
+    // Open the capture source
+    struct capture capture;
+    CLEAR(capture);
+    capture.source = source_open(video_device, source_flags, buffers);
+    if (!capture.source) {
         SDL_Quit();
         return 1;
     }
 
-    // Query device capabilities
-    struct v4l2_capability cap;
-    CLEAR(cap);
-    if (ioctl(fd, VIDIOC_QUERYCAP, &cap) < 0) {
-        perror("VIDIOC_QUERYCAP");
-        close(fd);
+    // Pick a capture format and start streaming
+    capture.nreq = nreq;
+    SDL_AtomicSet(&capture.window_size, window_size);
+    nreq.target_size = window_size;
+    struct negotiate_result capture_mode;
+    source_negotiate(capture.source, &nreq, &capture_mode);
+    if (stream_start(&capture, &capture_mode) < 0) {
+        source_close(capture.source);
         SDL_Quit();
         return 1;
     }
-    if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
-        fprintf(stderr, "Device does not support video capture\n");
-        close(fd);
+    if (software && capture.stream.fmt.fourcc != V4L2_PIX_FMT_YUYV) {
+        fprintf(stderr, "Error: -S needs a YUYV source\n");
+        stream_stop(&capture);
+        source_close(capture.source);
         SDL_Quit();
         return 1;
     }
 
-    // Set format (YUYV, 640x480)
-    struct v4l2_format fmt;
-    CLEAR(fmt);
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width = 640;
-    fmt.fmt.pix.height = 480;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
-    fmt.fmt.pix.field = V4L2_FIELD_ANY;
-    if (ioctl(fd, VIDIOC_S_FMT, &fmt) < 0) {
-        perror("VIDIOC_S_FMT");
-        close(fd);
-        SDL_Quit();
-        return 1;
+    // A transparent window needs a compositor and the GPU renderer;
+    // otherwise -a falls back to the shaped window
+    if (alpha && software) {
+        fprintf(stderr, "-S draws without a renderer, using a shaped window\n");
+        alpha = 0;
+    } else if (alpha && bench_seconds) {
+        alpha = 0;
+    } else if (alpha && alpha_window_setup() < 0) {
+        fprintf(stderr, "Transparent window unavailable, using a shaped window\n");
+        alpha = 0;
     }
 
-    // Calculate crop rectangle for square
-    int crop_size = fmt.fmt.pix.width < fmt.fmt.pix.height ? fmt.fmt.pix.width : fmt.fmt.pix.height;
-    SDL_Rect src_rect = {
-        .x = (fmt.fmt.pix.width - crop_size) / 2,
-        .y = (fmt.fmt.pix.height - crop_size) / 2,
-        .w = crop_size,
-        .h = crop_size
-    };
-
-    // Request buffers
-    struct v4l2_requestbuffers req;
-    CLEAR(req);
-    req.count = 4;
-    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
-    if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0) {
-        perror("VIDIOC_REQBUFS");
-        close(fd);
-        SDL_Quit();
-        return 1;
+    // Create a resizable shaped window with optional always-on-top
+    Uint32 window_flags = SDL_WINDOW_RESIZABLE;
+    if (always_on_top) {
+        window_flags |= SDL_WINDOW_ALWAYS_ON_TOP;
     }
-
-    // Map buffers
-    struct buffer *buffers = calloc(req.count, sizeof(*buffers));
-    for (unsigned int i = 0; i < req.count; i++) {
-        struct v4l2_buffer buf;
-        CLEAR(buf);
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = i;
-        if (ioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) {
-            perror("VIDIOC_QUERYBUF");
-            free(buffers);
-            close(fd);
-            SDL_Quit();
-            return 1;
+    SDL_Window *window;
+    SDL_Renderer *renderer = NULL;
+    for (;;) {
+        // Benchmarks run under SDL's dummy or offscreen drivers, which have
+        // no shaped windows; the mask is still built but not applied.
+        // SDL_CreateShapedWindow makes its window borderless itself; a
+        // transparent one has to ask, or the circle gets a title bar.
+        if (alpha) {
+            window = SDL_CreateWindow("Circam", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, window_size, window_size, window_flags | SDL_WINDOW_BORDERLESS);
+        } else if (bench_seconds) {
+            window = SDL_CreateWindow("Circam", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, window_size, window_size, window_flags);
+        } else {
+            window = SDL_CreateShapedWindow("Circam", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, window_size, window_size, window_flags);
         }
-        buffers[i].length = buf.length;
-        buffers[i].start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
-        if (buffers[i].start == MAP_FAILED) {
-            perror("mmap");
-            free(buffers);
-            close(fd);
+        if (!window) {
+            fprintf(stderr, "Window creation failed: %s\n", SDL_GetError());
+            stream_stop(&capture);
+            source_close(capture.source);
             SDL_Quit();
             return 1;
         }
-    }
 
-    // Queue buffers
-    for (unsigned int i = 0; i < req.count; i++) {
-        struct v4l2_buffer buf;
-        CLEAR(buf);
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = i;
-        if (ioctl(fd, VIDIOC_QBUF, &buf) < 0) {
-            perror("VIDIOC_QBUF");
-            free(buffers);
-            close(fd);
+        // Explicitly enable resizing
+        SDL_SetWindowResizable(window, SDL_TRUE);
+
+        // Create renderer, unless -S draws into the window surface itself.
+        // Its converter writes 32-bit pixels, so 16- and 24-bit visuals take
+        // the renderer instead; the window starts over, as a window surface
+        // and a renderer do not mix.
+        if (software) {
+            SDL_Surface *surface = SDL_GetWindowSurface(window);
+            if (surface && (surface->format->format == SDL_PIXELFORMAT_RGB888 ||
+                            surface->format->format == SDL_PIXELFORMAT_ARGB8888)) {
+                break;
+            }
+            fprintf(stderr, "-S needs a 32-bit RGB window surface, using the renderer\n");
+            SDL_DestroyWindow(window);
+            software = 0;
+            continue;
+        }
+        Uint32 renderer_flags = present_renderer_flags(present_policy);
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | renderer_flags);
+        if (!renderer && bench_seconds) {
+            renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE | renderer_flags);
+        }
+        if (!renderer) {
+            fprintf(stderr, "SDL_CreateRenderer failed: %s\n", SDL_GetError());
+            SDL_DestroyWindow(window);
+            stream_stop(&capture);
+            source_close(capture.source);
             SDL_Quit();
             return 1;
         }
-    }
-
-    // Start streaming
-    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (ioctl(fd, VIDIOC_STREAMON, &type) < 0) {
-        perror("VIDIOC_STREAMON");
-        free(buffers);
-        close(fd);
-        SDL_Quit();
-        return 1;
-    }
+        if (!alpha || alpha_renderer_supported(renderer)) {
+            break;
+        }
 
-    // Create a resizable shaped window with optional always-on-top
-    Uint32 window_flags = SDL_WINDOW_RESIZABLE;
-    if (always_on_top) {
-        window_flags |= SDL_WINDOW_ALWAYS_ON_TOP;
+        // Start over with a shaped window
+        fprintf(stderr, "The renderer cannot draw a transparent window, using a shaped window\n");
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        renderer = NULL;
+        alpha_window_cancel();
+        alpha = 0;
     }
-    SDL_Window *window = SDL_CreateShapedWindow("Circam", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, window_size, window_size, window_flags);
-    if (!window) {
-        fprintf(stderr, "SDL_CreateShapedWindow failed: %s\n", SDL_GetError());
-        ioctl(fd, VIDIOC_STREAMOFF, &type);
-        free(buffers);
-        close(fd);
-        SDL_Quit();
-        return 1;
+    struct converter converter;
+    CLEAR(converter);
+    if (software) {
+        converter_start(&converter, 0);
     }
 
-    // Explicitly enable resizing
-    SDL_SetWindowResizable(window, SDL_TRUE);
+    // Pace presentation by the refresh rate of the display the window opened on
+    SDL_DisplayMode display_mode;
+    CLEAR(display_mode);
+    SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &display_mode);
+    struct scheduler scheduler;
+    scheduler_init(&scheduler, present_policy, display_mode.refresh_rate);
 
-    // Create renderer
-    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    if (!renderer) {
-        fprintf(stderr, "SDL_CreateRenderer failed: %s\n", SDL_GetError());
-        SDL_DestroyWindow(window);
-        ioctl(fd, VIDIOC_STREAMOFF, &type);
-        free(buffers);
-        close(fd);
-        SDL_Quit();
-        return 1;
+    // Create initial circular shape. Masks are cached by size, so resizing
+    // back and forth reuses them. Transparent windows need none.
+    struct shape_cache shapes;
+    CLEAR(shapes);
+    SDL_WindowShapeMode mode = { .mode = ShapeModeBinarizeAlpha, .parameters.binarizationCutoff = 255 };
+    SDL_Surface *shape_surface = NULL;
+    if (!alpha) {
+        shape_surface = shape_cache_get(&shapes, window_size);
+        if (!shape_surface) {
+            SDL_DestroyRenderer(renderer);
+            SDL_DestroyWindow(window);
+            stream_stop(&capture);
+            source_close(capture.source);
+            SDL_Quit();
+            return 1;
+        }
+        SDL_SetWindowShape(window, shape_surface, &mode);
     }
 
-    // Create initial circular shape
-    SDL_Surface *shape_surface = create_circular_shape(window_size);
-    if (!shape_surface) {
+    // Create texture for the square crop
+    Uint32 texture_format = capture.stream.format->sdl_format;
+    int texture_size = capture.stream.src_rect.w;
+    SDL_Texture *texture = NULL;
+    if (!software) {
+        texture = SDL_CreateTexture(renderer, texture_format, SDL_TEXTUREACCESS_STREAMING, texture_size, texture_size);
+    }
+    if (!software && !texture) {
+        fprintf(stderr, "SDL_CreateTexture failed: %s\n", SDL_GetError());
+        shape_cache_free(&shapes);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
-        ioctl(fd, VIDIOC_STREAMOFF, &type);
-        free(buffers);
-        close(fd);
+        stream_stop(&capture);
+        source_close(capture.source);
         SDL_Quit();
         return 1;
     }
-    SDL_WindowShapeMode mode = { .mode = ShapeModeBinarizeAlpha, .parameters.binarizationCutoff = 255 };
-    SDL_SetWindowShape(window, shape_surface, &mode);
 
-    // Create texture for YUYV
-    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YUY2, SDL_TEXTUREACCESS_STREAMING, fmt.fmt.pix.width, fmt.fmt.pix.height);
-    if (!texture) {
-        fprintf(stderr, "SDL_CreateTexture failed: %s\n", SDL_GetError());
-        SDL_FreeSurface(shape_surface);
+    // Track current window size
+    int current_window_size = window_size;
+
+    // Drag through the hit test where the video driver supports it, and by
+    // moving the window on mouse motion otherwise
+    int manual_drag = SDL_SetWindowHitTest(window, hit_test, &current_window_size) < 0;
+
+    // Adaptive capture resolution follows the window unless -r fixed it. A
+    // recording keeps the mode it started with.
+    int adaptive = !nreq.width && !record_path;
+    int adapt_size = window_size;          // Window size capture was last evaluated for
+    int adapt_seen_size = window_size;     // Window size at adapt_change_time
+    Uint32 adapt_change_time = 0;
+
+    // Start the capture thread
+    capture.wake_fd = eventfd(0, EFD_CLOEXEC);
+    capture.stream_lock = SDL_CreateMutex();
+    capture.stats = stats_create(show_stats || bench_seconds);
+    // A fast replay delivers a frame per free buffer; draining would discard
+    // most of the recording
+    capture.drain = !(source_flags & SOURCE_REPLAY_FAST);
+    if (record_path) {
+        capture.recorder = recorder_open(record_path, &capture.stream.fmt, capture.stream.mode.interval);
+    }
+    tb_init(&capture.tb);
+    SDL_AtomicSet(&capture.running, 1);
+    capture.frame_event = SDL_RegisterEvents(1);
+    SDL_Thread *capture_tid = NULL;
+    if (capture.wake_fd >= 0 && capture.stream_lock && capture.stats && (!record_path || capture.recorder) &&
+        capture.frame_event != (Uint32)-1) {
+        capture_tid = SDL_CreateThread(capture_thread, "capture", &capture);
+    }
+    if (!capture_tid) {
+        fprintf(stderr, "Failed to start capture thread: %s\n", SDL_GetError());
+        stats_destroy(capture.stats);
+        recorder_close(capture.recorder);
+        if (capture.stream_lock) {
+            SDL_DestroyMutex(capture.stream_lock);
+        }
+        if (capture.wake_fd >= 0) {
+            close(capture.wake_fd);
+        }
+        SDL_DestroyTexture(texture);
+        shape_cache_free(&shapes);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
-        ioctl(fd, VIDIOC_STREAMOFF, &type);
-        free(buffers);
-        close(fd);
+        stream_stop(&capture);
+        source_close(capture.source);
         SDL_Quit();
         return 1;
     }
 
-    // Track current window size
-    int current_window_size = window_size;
+    // Input-to-present latency accounting for -l
+    Uint32 input_time = 0;      // Timestamp of the oldest input not yet presented
+    int input_waiting = 0;
+    Uint32 latency_sum = 0, latency_max = 0, latency_count = 0;
+    Uint32 latency_report_time = SDL_GetTicks();
+
+    // Present only when a new frame was uploaded or the window changed, so an
+    // idle or stalled camera costs no rendering at all
+    int redraw = 1;
+    int presented_size = 0; // Window size of the last present
+    int resize_target = 0;    // Wheel and keyboard resizing since the last frame, 0 when none
+    Uint64 resize_due = 0;    // Refresh deadline for resize_target when no frame arrives
+    int resize_direction = 0; // Sign of the last wheel or keyboard step
+    int resize_prefetch = 0;  // Build the masks ahead once the frame is presented
+    int frame_waiting = 0;  // The front frame is held by the scheduler until frame_due
+    Uint64 frame_due = 0;
+
+    // Headless runs have no user, so --bench -l makes its own input
+    int wheel_step = 1;
+    SDL_TimerID input_timer = 0;
+    if (bench_seconds && log_latency) {
+        input_timer = SDL_AddTimer(BENCH_INPUT_MS, inject_wheel, &wheel_step);
+        if (!input_timer) {
+            fprintf(stderr, "SDL_AddTimer failed: %s\n", SDL_GetError());
+        }
+    }
 
     // Main loop
+    Uint32 bench_start = SDL_GetTicks();
     SDL_Event event;
     int running = 1;
     while (running) {
-        while (SDL_PollEvent(&event)) {
+        // Sleep until an input event or a new frame arrives. The only timed
+        // wakeups are the deadlines of a pending resize, of a held wheel or
+        // keyboard resize, of capture adaptation and of the next stats report.
+        int timeout = bench_seconds && !show_stats ? -1 : stats_report(capture.stats);
+        if (bench_seconds) {
+            Uint32 elapsed = SDL_GetTicks() - bench_start;
+            if (elapsed >= (Uint32)bench_seconds * 1000) {
+                break;
+            }
+            int remaining = bench_seconds * 1000 - elapsed;
+            if (timeout < 0 || remaining < timeout) {
+                timeout = remaining;
+            }
+        }
+        if (frame_waiting) {
+            int remaining = scheduler_timeout(frame_due);
+            if (timeout < 0 || remaining < timeout) {
+                timeout = remaining;
+            }
+        }
+        if (resize_target) {
+            int remaining = scheduler_timeout(resize_due);
+            if (timeout < 0 || remaining < timeout) {
+                timeout = remaining;
+            }
+        }
+        if (pending_resize) {
+            Uint32 elapsed = SDL_GetTicks() - last_resize_time;
+            int remaining = elapsed >= RESIZE_STABILIZE_MS ? 0 : (int)(RESIZE_STABILIZE_MS - elapsed);
+            if (timeout < 0 || remaining < timeout) {
+                timeout = remaining;
+            }
+        }
+        if (adaptive && adapt_size != current_window_size) {
+            Uint32 elapsed = SDL_GetTicks() - adapt_change_time;
+            int remaining = elapsed >= ADAPT_STABLE_MS ? 0 : (int)(ADAPT_STABLE_MS - elapsed);
+            if (timeout < 0 || remaining < timeout) {
+                timeout = remaining;
+            }
+        }
+        int have_event = SDL_WaitEventTimeout(&event, timeout);
+        while (have_event) {
+            if (event.type == capture.frame_event) {
+                SDL_AtomicSet(&capture.event_pending, 0);
+            } else if (log_latency && !input_waiting &&
+                       (event.type == SDL_KEYDOWN || event.type == SDL_MOUSEBUTTONDOWN ||
+                        event.type == SDL_MOUSEBUTTONUP || event.type == SDL_MOUSEMOTION ||
+                        event.type == SDL_MOUSEWHEEL)) {
+                input_waiting = 1;
+                input_time = event.common.timestamp;
+            }
             switch (event.type) {
                 case SDL_QUIT:
                     running = 0;
@@ -287,34 +911,22 @@ int main(int argc, char *argv[]) {
                 case SDL_KEYDOWN:
                     if (event.key.keysym.sym == SDLK_ESCAPE) {
                         running = 0;
+                    } else if (event.key.keysym.sym == SDLK_s) {
+                        // Toggle the stats report
+                        stats_set_enabled(capture.stats, !stats_enabled(capture.stats));
                     } else if (event.key.keysym.sym == SDLK_PLUS || event.key.keysym.sym == SDLK_EQUALS) {
                         // Increase size
-                        window_size = current_window_size + SIZE_STEP;
-                        if (window_size < MIN_WINDOW_SIZE) window_size = MIN_WINDOW_SIZE;
-                        SDL_SetWindowSize(window, window_size, window_size);
-                        SDL_FreeSurface(shape_surface);
-                        shape_surface = create_circular_shape(window_size);
-                        if (shape_surface) {
-                            SDL_SetWindowShape(window, shape_surface, &mode);
-                        }
-                        current_window_size = window_size;
-                        // printf("Keyboard resized to %dx%d\n", window_size, window_size);
+                        resize_direction = 1;
+                        resize_target = (resize_target ? resize_target : current_window_size) + SIZE_STEP;
                     } else if (event.key.keysym.sym == SDLK_MINUS) {
                         // Decrease size
-                        window_size = current_window_size - SIZE_STEP;
-                        if (window_size < MIN_WINDOW_SIZE) window_size = MIN_WINDOW_SIZE;
-                        SDL_SetWindowSize(window, window_size, window_size);
-                        SDL_FreeSurface(shape_surface);
-                        shape_surface = create_circular_shape(window_size);
-                        if (shape_surface) {
-                            SDL_SetWindowShape(window, shape_surface, &mode);
-                        }
-                        current_window_size = window_size;
-                        // printf("Keyboard resized to %dx%d\n", window_size, window_size);
+                        resize_direction = -1;
+                        resize_target = (resize_target ? resize_target : current_window_size) - SIZE_STEP;
+                        if (resize_target < MIN_WINDOW_SIZE) resize_target = MIN_WINDOW_SIZE;
                     }
                     break;
                 case SDL_MOUSEBUTTONDOWN:
-                    if (event.button.button == SDL_BUTTON_LEFT) {
+                    if (event.button.button == SDL_BUTTON_LEFT && manual_drag) {
                         dragging = 1;
                         SDL_GetGlobalMouseState(&drag_start_x, &drag_start_y);
                         SDL_GetWindowPosition(window, &win_start_x, &win_start_y);
@@ -335,23 +947,24 @@ int main(int argc, char *argv[]) {
                     }
                     break;
                 case SDL_MOUSEWHEEL:
+                    // Steps only accumulate here; the window follows once per frame
+                    if (!resize_target) {
+                        resize_target = current_window_size;
+                    }
                     if (event.wheel.y > 0) { // Wheel up
-                        window_size = current_window_size + SIZE_STEP;
+                        resize_direction = 1;
+                        resize_target += SIZE_STEP;
                     } else if (event.wheel.y < 0) { // Wheel down
-                        window_size = current_window_size - SIZE_STEP;
+                        resize_direction = -1;
+                        resize_target -= SIZE_STEP;
                     }
-                    if (window_size < MIN_WINDOW_SIZE) window_size = MIN_WINDOW_SIZE;
-                    SDL_SetWindowSize(window, window_size, window_size);
-                    SDL_FreeSurface(shape_surface);
-                    shape_surface = create_circular_shape(window_size);
-                    if (shape_surface) {
-                        SDL_SetWindowShape(window, shape_surface, &mode);
-                    }
-                    current_window_size = window_size;
-                    // printf("Mouse wheel resized to %dx%d\n", window_size, window_size);
+                    if (resize_target < MIN_WINDOW_SIZE) resize_target = MIN_WINDOW_SIZE;
                     break;
                 case SDL_WINDOWEVENT:
-                    if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                    if (event.window.event == SDL_WINDOWEVENT_EXPOSED || event.window.event == SDL_WINDOWEVENT_SHOWN ||
+                        event.window.event == SDL_WINDOWEVENT_RESTORED || event.window.event == SDL_WINDOWEVENT_MOVED) {
+                        redraw = 1;
+                    } else if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
                         int new_size = event.window.data1 < event.window.data2 ? event.window.data1 : event.window.data2;
                         if (new_size >= MIN_WINDOW_SIZE && new_size != current_window_size) {
                             pending_resize = 1;
@@ -362,6 +975,7 @@ int main(int argc, char *argv[]) {
                     }
                     break;
             }
+            have_event = SDL_PollEvent(&event);
         }
 
         // Check for stabilized resize
@@ -372,8 +986,7 @@ int main(int argc, char *argv[]) {
             if (w == h && w == pending_size) {
                 window_size = pending_size;
                 current_window_size = window_size;
-                SDL_FreeSurface(shape_surface);
-                shape_surface = create_circular_shape(window_size);
+                shape_surface = alpha ? NULL : shape_cache_get(&shapes, window_size);
                 if (shape_surface) {
                     SDL_SetWindowShape(window, shape_surface, &mode);
                 }
@@ -384,63 +997,211 @@ int main(int argc, char *argv[]) {
             pending_resize = 0;
         }
 
-        // Render cropped square using current window size
-        SDL_Rect dst_rect = { .x = 0, .y = 0, .w = current_window_size, .h = current_window_size };
-        SDL_RenderClear(renderer);
-        SDL_RenderCopy(renderer, texture, &src_rect, &dst_rect);
-        SDL_RenderPresent(renderer);
+        // A resize step holds until the next frame or, with no frame coming,
+        // one display refresh
+        if (resize_target && !resize_due) {
+            resize_due = stats_now_us() + scheduler.refresh_us;
+        }
 
-        // Debug: Log sizes
-        //int w, h;
-        //SDL_GetWindowSize(window, &w, &h);
-        //printf("Render: window_size=%d, actual_size=%dx%d, dst_rect(w=%d, h=%d, x=%d, y=%d)\n",
-        //       current_window_size, w, h, dst_rect.w, dst_rect.h, dst_rect.x, dst_rect.y);
+        // Let capture follow a window size that has held for a while. The
+        // ratios give hysteresis, so small resizes never restart the stream.
+        if (current_window_size != adapt_seen_size) {
+            adapt_seen_size = current_window_size;
+            adapt_change_time = SDL_GetTicks();
+        }
+        SDL_AtomicSet(&capture.window_size, current_window_size);
+        if (adaptive && adapt_size != current_window_size && SDL_GetTicks() - adapt_change_time >= ADAPT_STABLE_MS) {
+            int capture_size = SDL_AtomicGet(&capture.capture_size);
+            adapt_size = current_window_size;
+            if (current_window_size > capture_size * ADAPT_UP_RATIO || current_window_size * ADAPT_DOWN_RATIO < capture_size) {
+                SDL_AtomicSet(&capture.reconfigure, current_window_size);
+                uint64_t wake = 1;
+                if (write(capture.wake_fd, &wake, sizeof(wake)) < 0) {
+                    perror("write wakeup");
+                }
+            }
+        }
 
-        // Wait for buffer using select
-        fd_set fds;
-        struct timeval tv = { .tv_sec = 2, .tv_usec = 0 };
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-        int r = select(fd + 1, &fds, NULL, NULL, &tv);
-        if (r < 0) {
-            perror("select");
-            continue;
+        // Upload the newest frame once the scheduler says it is due. While the
+        // capture thread holds the stream lock to reconfigure, the old texture
+        // stays on screen; the restart also drops a frame that was waiting.
+        struct frame shown = { .index = -1 };
+        int shown_size = 0; // Crop size of the shown frame, for --g2g
+        struct stats_timer timer;
+        if (SDL_TryLockMutex(capture.stream_lock) == 0) {
+            const struct stream *stream = &capture.stream;
+            const struct frame *frame = frame_waiting ? &capture.tb.slots[capture.tb.front] : tb_acquire(&capture.tb);
+            if (frame && frame->index >= 0) {
+                if (!frame_waiting) {
+                    frame_due = scheduler_due(&scheduler, frame->timestamp);
+                }
+                frame_waiting = scheduler_timeout(frame_due) > 0;
+            } else {
+                frame_waiting = 0;
+            }
+            if (frame && frame->index >= 0 && !frame_waiting && !software) {
+                // MJPEG frames come DCT-scaled to the window size, so the
+                // texture follows the decoded size
+                const struct mjpeg_image *img = stream->mjpeg ? mjpeg_output(stream->mjpeg, frame->index) : NULL;
+                int size = img ? img->width : stream->src_rect.w;
+                if (stream->format->sdl_format != texture_format || size != texture_size) {
+                    SDL_DestroyTexture(texture);
+                    texture_format = stream->format->sdl_format;
+                    texture_size = size;
+                    texture = SDL_CreateTexture(renderer, texture_format, SDL_TEXTUREACCESS_STREAMING, size, size);
+                    if (!texture) {
+                        fprintf(stderr, "SDL_CreateTexture failed: %s\n", SDL_GetError());
+                        running = 0;
+                    }
+                }
+                stats_begin(capture.stats, &timer);
+                if (texture && img) {
+                    upload_image(texture, img);
+                } else if (texture) {
+                    upload_crop(texture, stream->fmt.fourcc, frame->data, stream->fmt.pitch, stream->fmt.height,
+                                &stream->src_rect);
+                }
+                stats_end(capture.stats, STAGE_UPLOAD, &timer);
+            }
+            if (frame && frame->index >= 0 && !frame_waiting) {
+                shown = *frame;
+                shown_size = stream->src_rect.w;
+                redraw = 1;
+            }
+            SDL_UnlockMutex(capture.stream_lock);
+        } else {
+            frame_waiting = 0;
         }
-        if (r == 0) {
-            fprintf(stderr, "select timeout\n");
+        if (!software && !texture) {
+            break;
+        }
+
+        // Apply wheel and keyboard resizing once per frame, however many steps
+        // arrived since the last one: a single window resize and shape update
+        if (resize_target && (shown.index >= 0 || scheduler_timeout(resize_due) == 0)) {
+            if (resize_target != current_window_size) {
+                set_window_size(window, alpha ? NULL : &shapes, &mode, resize_target);
+                window_size = current_window_size = resize_target;
+                resize_prefetch = !alpha;
+            }
+            resize_target = 0;
+            resize_due = 0;
+        }
+        if (current_window_size != presented_size) {
+            redraw = 1;
+        }
+        // With -S the frame is converted at draw time, so a frame the
+        // scheduler still holds back must not be drawn early
+        if (!redraw || (software && frame_waiting)) {
             continue;
         }
 
-        // Dequeue buffer
-        struct v4l2_buffer buf;
-        CLEAR(buf);
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        if (ioctl(fd, VIDIOC_DQBUF, &buf) < 0) {
-            perror("VIDIOC_DQBUF");
+        // Render cropped square using current window size
+        SDL_Rect dst_rect = { .x = 0, .y = 0, .w = current_window_size, .h = current_window_size };
+        SDL_Surface *surface = NULL;
+        stats_begin(capture.stats, &timer);
+        if (software) {
+            surface = draw_software(window, &capture, &converter, current_window_size);
+        } else if (alpha) {
+            alpha_render(renderer, texture, current_window_size);
+        } else {
+            SDL_RenderClear(renderer);
+            SDL_RenderCopy(renderer, texture, NULL, &dst_rect);
+        }
+        stats_end(capture.stats, STAGE_RENDER, &timer);
+        if (software && !surface) {
             continue;
         }
+        redraw = 0;
+        presented_size = current_window_size;
+        Uint64 stamp = 0;
+        if (glass && shown.index >= 0) {
+            stamp = read_stamp(renderer, surface, current_window_size, shown_size);
+        }
+        stats_begin(capture.stats, &timer);
+        if (software) {
+            // Only the bands around the circle changed
+            SDL_UpdateWindowSurfaceRects(window, converter.spans.rects, converter.spans.n_rects);
+        } else {
+            SDL_RenderPresent(renderer);
+        }
+        stats_end(capture.stats, STAGE_PRESENT, &timer);
+        if (shown.index >= 0) {
+            stats_presented(capture.stats, shown.timestamp);
+            if (glass) {
+                stats_stamped(capture.stats, stamp, shown.timestamp);
+            }
+        }
 
-        // Update texture with new frame
-        SDL_UpdateTexture(texture, NULL, buffers[buf.index].start, fmt.fmt.pix.width * 2);
+        // Build the masks for the next steps in the resize direction now that
+        // the frame is out, so they come from the cache if the user keeps going
+        if (resize_prefetch) {
+            for (int step = 1; step <= RESIZE_PREFETCH; step++) {
+                int size = current_window_size + resize_direction * step * SIZE_STEP;
+                if (size >= MIN_WINDOW_SIZE) {
+                    shape_cache_get(&shapes, size);
+                }
+            }
+            resize_prefetch = 0;
+        }
 
-        // Requeue buffer
-        if (ioctl(fd, VIDIOC_QBUF, &buf) < 0) {
-            perror("VIDIOC_QBUF");
+        if (log_latency && input_waiting) {
+            Uint32 now = SDL_GetTicks();
+            Uint32 latency = now - input_time;
+            latency_sum += latency;
+            latency_count++;
+            if (latency > latency_max) latency_max = latency;
+            input_waiting = 0;
+            if (now - latency_report_time >= LATENCY_REPORT_MS) {
+                report_latency(latency_count, latency_sum, latency_max);
+                latency_sum = latency_max = latency_count = 0;
+                latency_report_time = now;
+            }
         }
+
+        // Debug: Log sizes
+        //int w, h;
+        //SDL_GetWindowSize(window, &w, &h);
+        //printf("Render: window_size=%d, actual_size=%dx%d, dst_rect(w=%d, h=%d, x=%d, y=%d)\n",
+        //       current_window_size, w, h, dst_rect.w, dst_rect.h, dst_rect.x, dst_rect.y);
+    }
+
+    if (input_timer) {
+        SDL_RemoveTimer(input_timer);
+    }
+    if (log_latency && latency_count) {
+        report_latency(latency_count, latency_sum, latency_max);
     }
 
+    // Stop the capture thread before tearing down the stream
+    SDL_AtomicSet(&capture.running, 0);
+    uint64_t wake = 1;
+    if (write(capture.wake_fd, &wake, sizeof(wake)) < 0) {
+        perror("write wakeup");
+    }
+    SDL_WaitThread(capture_tid, NULL);
+    SDL_DestroyMutex(capture.stream_lock);
+    if (bench_seconds) {
+        stats_write_json(capture.stats, stdout);
+    }
+    stats_destroy(capture.stats);
+    if (recorder_close(capture.recorder) < 0) {
+        fprintf(stderr, "Recording %s is incomplete\n", record_path);
+    }
+    close(capture.wake_fd);
+
     // Cleanup
-    SDL_DestroyTexture(texture);
-    SDL_FreeSurface(shape_surface);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    ioctl(fd, VIDIOC_STREAMOFF, &type);
-    for (unsigned int i = 0; i < req.count; i++) {
-        munmap(buffers[i].start, buffers[i].length);
+    if (texture) {
+        SDL_DestroyTexture(texture);
+    }
+    converter_free(&converter);
+    shape_cache_free(&shapes);
+    if (renderer) {
+        SDL_DestroyRenderer(renderer);
     }
-    free(buffers);
-    close(fd);
+    SDL_DestroyWindow(window);
+    stream_stop(&capture);
+    source_close(capture.source);
     SDL_Quit();
 
     return 0;
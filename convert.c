@@ -0,0 +1,464 @@
+#include "convert.h"
+#include "cpu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86_KERNELS 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+// BT.601 limited range in 16-bit fixed point with 6 fraction bits:
+//   R = 1.164 (Y - 16) + 1.596 (V - 128)
+//   G = 1.164 (Y - 16) - 0.813 (V - 128) - 0.391 (U - 128)
+//   B = 1.164 (Y - 16) + 2.018 (U - 128)
+// The luma factor is 74.5, applied as 74 x + x / 2. Sums saturate at 16
+// bits, exactly like the vector adds, so every kernel produces the same
+// pixels.
+#define CY 74
+#define CRV 102
+#define CGV 52
+#define CGU 25
+#define CBU 129
+
+static inline int sat16(int v) {
+    return v < -32768 ? -32768 : v > 32767 ? 32767 : v;
+}
+
+static inline Uint32 clamp8(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : (Uint32)v;
+}
+
+void convert_row_c(const Uint8 *y, const Uint8 *u, const Uint8 *v, Uint32 *out, int n) {
+    for (int i = 0; i < n; i++) {
+        int luma = (y[i] - 16) * CY + ((y[i] - 16) >> 1);
+        int cb = u[i] - 128, cr = v[i] - 128;
+        int r = sat16(sat16(luma + cr * CRV) + 32) >> 6;
+        int g = sat16(sat16(sat16(luma - cr * CGV) - cb * CGU) + 32) >> 6;
+        int b = sat16(sat16(luma + cb * CBU) + 32) >> 6;
+        out[i] = 0xFF000000u | clamp8(r) << 16 | clamp8(g) << 8 | clamp8(b);
+    }
+}
+
+#if X86_KERNELS
+// Each x86 kernel is compiled for its own target whatever the build flags,
+// and only called once cpuid says it can run. Tails go to the next narrower
+// kernel.
+
+// 8 pixels per iteration
+__attribute__((target("sse2"))) static void convert_row_sse2(const Uint8 *y, const Uint8 *u, const Uint8 *v,
+                                                              Uint32 *out, int n) {
+    const __m128i zero = _mm_setzero_si128(), c16 = _mm_set1_epi16(16), c128 = _mm_set1_epi16(128);
+    const __m128i round = _mm_set1_epi16(32), alpha = _mm_set1_epi8((char)0xFF);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i luma = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(y + i)), zero);
+        __m128i cb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(u + i)), zero);
+        __m128i cr = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(v + i)), zero);
+        luma = _mm_sub_epi16(luma, c16);
+        luma = _mm_add_epi16(_mm_mullo_epi16(luma, _mm_set1_epi16(CY)), _mm_srai_epi16(luma, 1));
+        cb = _mm_sub_epi16(cb, c128);
+        cr = _mm_sub_epi16(cr, c128);
+        __m128i r = _mm_adds_epi16(luma, _mm_mullo_epi16(cr, _mm_set1_epi16(CRV)));
+        __m128i g = _mm_adds_epi16(luma, _mm_mullo_epi16(cr, _mm_set1_epi16(-CGV)));
+        g = _mm_adds_epi16(g, _mm_mullo_epi16(cb, _mm_set1_epi16(-CGU)));
+        __m128i b = _mm_adds_epi16(luma, _mm_mullo_epi16(cb, _mm_set1_epi16(CBU)));
+        r = _mm_srai_epi16(_mm_adds_epi16(r, round), 6);
+        g = _mm_srai_epi16(_mm_adds_epi16(g, round), 6);
+        b = _mm_srai_epi16(_mm_adds_epi16(b, round), 6);
+
+        __m128i bg = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_packus_epi16(g, g));
+        __m128i ra = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), alpha);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128((__m128i *)(out + i + 4), _mm_unpackhi_epi16(bg, ra));
+    }
+    convert_row_c(y + i, u + i, v + i, out + i, n - i);
+}
+
+// 16 pixels per iteration
+__attribute__((target("avx2"))) static void convert_row_avx2(const Uint8 *y, const Uint8 *u, const Uint8 *v,
+                                                              Uint32 *out, int n) {
+    const __m256i c16 = _mm256_set1_epi16(16), c128 = _mm256_set1_epi16(128), round = _mm256_set1_epi16(32);
+    const __m256i alpha = _mm256_set1_epi8((char)0xFF);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i luma = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + i)));
+        __m256i cb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(u + i)));
+        __m256i cr = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(v + i)));
+        luma = _mm256_sub_epi16(luma, c16);
+        luma = _mm256_add_epi16(_mm256_mullo_epi16(luma, _mm256_set1_epi16(CY)), _mm256_srai_epi16(luma, 1));
+        cb = _mm256_sub_epi16(cb, c128);
+        cr = _mm256_sub_epi16(cr, c128);
+        __m256i r = _mm256_adds_epi16(luma, _mm256_mullo_epi16(cr, _mm256_set1_epi16(CRV)));
+        __m256i g = _mm256_adds_epi16(luma, _mm256_mullo_epi16(cr, _mm256_set1_epi16(-CGV)));
+        g = _mm256_adds_epi16(g, _mm256_mullo_epi16(cb, _mm256_set1_epi16(-CGU)));
+        __m256i b = _mm256_adds_epi16(luma, _mm256_mullo_epi16(cb, _mm256_set1_epi16(CBU)));
+        r = _mm256_srai_epi16(_mm256_adds_epi16(r, round), 6);
+        g = _mm256_srai_epi16(_mm256_adds_epi16(g, round), 6);
+        b = _mm256_srai_epi16(_mm256_adds_epi16(b, round), 6);
+
+        // Packing works within 128-bit lanes: lane 0 holds pixels 0-7,
+        // lane 1 pixels 8-15
+        __m256i r8 = _mm256_packus_epi16(r, r), g8 = _mm256_packus_epi16(g, g), b8 = _mm256_packus_epi16(b, b);
+        __m256i bg = _mm256_unpacklo_epi8(b8, g8);
+        __m256i ra = _mm256_unpacklo_epi8(r8, alpha);
+        __m256i lo = _mm256_unpacklo_epi16(bg, ra); // Pixels 0-3 and 8-11
+        __m256i hi = _mm256_unpackhi_epi16(bg, ra); // Pixels 4-7 and 12-15
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    convert_row_sse2(y + i, u + i, v + i, out + i, n - i);
+}
+
+// 32 pixels per iteration
+__attribute__((target("avx512bw"))) static void convert_row_avx512bw(const Uint8 *y, const Uint8 *u, const Uint8 *v,
+                                                                      Uint32 *out, int n) {
+    const __m512i c16 = _mm512_set1_epi16(16), c128 = _mm512_set1_epi16(128), round = _mm512_set1_epi16(32);
+    const __m512i alpha = _mm512_set1_epi8((char)0xFF);
+    // Qword indices putting lanes back in pixel order, see below
+    const __m512i first = _mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0);
+    const __m512i second = _mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4);
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512i luma = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(y + i)));
+        __m512i cb = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(u + i)));
+        __m512i cr = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(v + i)));
+        luma = _mm512_sub_epi16(luma, c16);
+        luma = _mm512_add_epi16(_mm512_mullo_epi16(luma, _mm512_set1_epi16(CY)), _mm512_srai_epi16(luma, 1));
+        cb = _mm512_sub_epi16(cb, c128);
+        cr = _mm512_sub_epi16(cr, c128);
+        __m512i r = _mm512_adds_epi16(luma, _mm512_mullo_epi16(cr, _mm512_set1_epi16(CRV)));
+        __m512i g = _mm512_adds_epi16(luma, _mm512_mullo_epi16(cr, _mm512_set1_epi16(-CGV)));
+        g = _mm512_adds_epi16(g, _mm512_mullo_epi16(cb, _mm512_set1_epi16(-CGU)));
+        __m512i b = _mm512_adds_epi16(luma, _mm512_mullo_epi16(cb, _mm512_set1_epi16(CBU)));
+        r = _mm512_srai_epi16(_mm512_adds_epi16(r, round), 6);
+        g = _mm512_srai_epi16(_mm512_adds_epi16(g, round), 6);
+        b = _mm512_srai_epi16(_mm512_adds_epi16(b, round), 6);
+
+        // Lane k holds pixels 8k to 8k+7; lo gets the first four of each
+        // lane and hi the last four
+        __m512i r8 = _mm512_packus_epi16(r, r), g8 = _mm512_packus_epi16(g, g), b8 = _mm512_packus_epi16(b, b);
+        __m512i bg = _mm512_unpacklo_epi8(b8, g8);
+        __m512i ra = _mm512_unpacklo_epi8(r8, alpha);
+        __m512i lo = _mm512_unpacklo_epi16(bg, ra);
+        __m512i hi = _mm512_unpackhi_epi16(bg, ra);
+        _mm512_storeu_si512(out + i, _mm512_permutex2var_epi64(lo, first, hi));
+        _mm512_storeu_si512(out + i + 16, _mm512_permutex2var_epi64(lo, second, hi));
+    }
+    convert_row_avx2(y + i, u + i, v + i, out + i, n - i);
+}
+#elif defined(__ARM_NEON)
+// 8 pixels per iteration
+static void convert_row_neon(const Uint8 *y, const Uint8 *u, const Uint8 *v, Uint32 *out, int n) {
+    const int16x8_t c16 = vdupq_n_s16(16), c128 = vdupq_n_s16(128), round = vdupq_n_s16(32);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t luma = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(y + i)));
+        int16x8_t cb = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(u + i))), c128);
+        int16x8_t cr = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(v + i))), c128);
+        luma = vsubq_s16(luma, c16);
+        luma = vaddq_s16(vmulq_n_s16(luma, CY), vshrq_n_s16(luma, 1));
+        int16x8_t r = vqaddq_s16(luma, vmulq_n_s16(cr, CRV));
+        int16x8_t g = vqaddq_s16(vqaddq_s16(luma, vmulq_n_s16(cr, -CGV)), vmulq_n_s16(cb, -CGU));
+        int16x8_t b = vqaddq_s16(luma, vmulq_n_s16(cb, CBU));
+        uint8x8x4_t pixels;
+        pixels.val[0] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(b, round), 6));
+        pixels.val[1] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(g, round), 6));
+        pixels.val[2] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(r, round), 6));
+        pixels.val[3] = vdup_n_u8(0xFF);
+        vst4_u8((uint8_t *)(out + i), pixels);
+    }
+    convert_row_c(y + i, u + i, v + i, out + i, n - i);
+}
+#endif
+
+// Kernels built into this binary, lowest level first. A level without a
+// kernel of its own (SSSE3 adds nothing this arithmetic uses) runs the one
+// below it.
+typedef void (*row_fn)(const Uint8 *y, const Uint8 *u, const Uint8 *v, Uint32 *out, int n);
+
+static const struct kernel {
+    enum cpu_level level;
+    row_fn row;
+} kernels[] = {
+    { CPU_C, convert_row_c },
+#if X86_KERNELS
+    { CPU_SSE2, convert_row_sse2 },
+    { CPU_AVX2, convert_row_avx2 },
+    { CPU_AVX512BW, convert_row_avx512bw },
+#elif defined(__ARM_NEON)
+    { CPU_NEON, convert_row_neon },
+#endif
+};
+
+static const struct kernel *kernel;
+
+int convert_use(enum cpu_level level) {
+    if (!cpu_supports(level)) {
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (kernels[i].level <= level) {
+            kernel = &kernels[i];
+        }
+    }
+    return kernel->level;
+}
+
+static const struct kernel *current_kernel(void) {
+    if (!kernel) {
+        convert_use(cpu_level());
+    }
+    return kernel;
+}
+
+const char *convert_kernel(void) {
+    return cpu_level_name(current_kernel()->level);
+}
+
+void convert_row(const Uint8 *y, const Uint8 *u, const Uint8 *v, Uint32 *out, int n) {
+    current_kernel()->row(y, u, v, out, n);
+}
+
+// Helper threads converting bands of rows alongside the caller. Bands are
+// claimed one at a time from a shared counter, so rows near the top and
+// bottom of the circle, which are short, balance out on their own.
+struct convert_worker {
+    struct convert_pool *pool;
+    SDL_Thread *thread;
+    int index; // Which scratch row the worker gathers into; the caller is 0
+};
+
+struct convert_pool {
+    struct converter *conv;
+    SDL_mutex *lock;
+    SDL_cond *start, *done;
+    int stopping;
+    Uint32 generation; // Bumped for every frame
+    int busy;          // Helpers still working on this generation
+
+    // The frame being converted
+    const Uint8 *origin;
+    int pitch;
+    Uint32 *pixels;
+    int dst_pitch;
+    row_fn row;
+    int band_rows, bands;
+    SDL_atomic_t next_band;
+
+    struct convert_worker workers[CONVERT_MAX_THREADS - 1];
+    int n_workers;
+};
+
+static void free_tables(struct converter *conv) {
+    free(conv->x_offset);
+    free(conv->row);
+    shape_spans_free(&conv->spans);
+    free(conv->y);
+    free(conv->u);
+    free(conv->v);
+    conv->x_offset = conv->row = NULL;
+    conv->y = conv->u = conv->v = NULL;
+    conv->size = conv->crop = 0;
+}
+
+static void stop_pool(struct convert_pool *pool) {
+    if (pool->lock) {
+        SDL_LockMutex(pool->lock);
+        pool->stopping = 1;
+        SDL_CondBroadcast(pool->start);
+        SDL_UnlockMutex(pool->lock);
+    }
+    for (int i = 0; i < pool->n_workers; i++) {
+        SDL_WaitThread(pool->workers[i].thread, NULL);
+    }
+    if (pool->done) SDL_DestroyCond(pool->done);
+    if (pool->start) SDL_DestroyCond(pool->start);
+    if (pool->lock) SDL_DestroyMutex(pool->lock);
+    free(pool);
+}
+
+void converter_free(struct converter *conv) {
+    if (conv->pool) {
+        stop_pool(conv->pool);
+    }
+    free_tables(conv);
+    CLEAR(*conv);
+}
+
+// Window rows [y0, y1)
+static void convert_rows(struct converter *conv, row_fn row, int worker, const Uint8 *origin, int pitch,
+                         Uint32 *pixels, int dst_pitch, int y0, int y1) {
+    Uint8 *ys = conv->y + (size_t)worker * conv->size;
+    Uint8 *us = conv->u + (size_t)worker * conv->size;
+    Uint8 *vs = conv->v + (size_t)worker * conv->size;
+    for (int y = y0; y < y1; y++) {
+        int x0 = conv->spans.x0[y], n = conv->spans.x1[y] - x0;
+        if (n <= 0) {
+            continue;
+        }
+
+        // Gather the samples of this row's span, then convert them in one go
+        // while they are still in L1
+        const Uint8 *src = origin + (size_t)conv->row[y] * pitch;
+        const int *offset = conv->x_offset + x0;
+        for (int i = 0; i < n; i++) {
+            const Uint8 *pair = src + (offset[i] & ~3);
+            ys[i] = src[offset[i]];
+            us[i] = pair[1];
+            vs[i] = pair[3];
+        }
+        row(ys, us, vs, (Uint32 *)((Uint8 *)pixels + (size_t)y * dst_pitch) + x0, n);
+    }
+}
+
+static void convert_bands(struct convert_pool *pool, int worker) {
+    struct converter *conv = pool->conv;
+    int band;
+    while ((band = SDL_AtomicAdd(&pool->next_band, 1)) < pool->bands) {
+        int y0 = band * pool->band_rows;
+        int y1 = y0 + pool->band_rows < conv->size ? y0 + pool->band_rows : conv->size;
+        convert_rows(conv, pool->row, worker, pool->origin, pool->pitch, pool->pixels, pool->dst_pitch, y0, y1);
+    }
+}
+
+static int worker_thread(void *data) {
+    struct convert_worker *w = data;
+    struct convert_pool *pool = w->pool;
+    Uint32 seen = 0;
+    SDL_LockMutex(pool->lock);
+    while (!pool->stopping) {
+        if (pool->generation == seen) {
+            SDL_CondWait(pool->start, pool->lock);
+            continue;
+        }
+        seen = pool->generation;
+        SDL_UnlockMutex(pool->lock);
+
+        convert_bands(pool, w->index);
+
+        SDL_LockMutex(pool->lock);
+        if (--pool->busy == 0) {
+            SDL_CondSignal(pool->done);
+        }
+    }
+    SDL_UnlockMutex(pool->lock);
+    return 0;
+}
+
+int converter_start(struct converter *conv, int threads) {
+    if (threads <= 0) {
+        threads = SDL_GetCPUCount();
+    }
+    if (threads > CONVERT_MAX_THREADS) threads = CONVERT_MAX_THREADS;
+    if (conv->pool || threads <= 1) {
+        return 0;
+    }
+
+    struct convert_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        perror("calloc");
+        return -1;
+    }
+    pool->conv = conv;
+    pool->lock = SDL_CreateMutex();
+    pool->start = SDL_CreateCond();
+    pool->done = SDL_CreateCond();
+    if (!pool->lock || !pool->start || !pool->done) {
+        fprintf(stderr, "Converter threads failed: %s\n", SDL_GetError());
+        stop_pool(pool);
+        return -1;
+    }
+    for (int i = 0; i < threads - 1; i++) {
+        struct convert_worker *w = &pool->workers[i];
+        w->pool = pool;
+        w->index = i + 1;
+        w->thread = SDL_CreateThread(worker_thread, "convert", w);
+        if (!w->thread) {
+            fprintf(stderr, "Converter threads failed: %s\n", SDL_GetError());
+            stop_pool(pool);
+            return -1;
+        }
+        pool->n_workers++;
+    }
+
+    // Scratch rows are per worker now
+    free_tables(conv);
+    conv->pool = pool;
+    return 0;
+}
+
+// Nearest neighbour: window pixel i samples the crop pixel under its center
+static int build_tables(struct converter *conv, int size, int crop) {
+    int workers = conv->pool ? conv->pool->n_workers + 1 : 1;
+    free_tables(conv);
+    conv->x_offset = malloc(size * sizeof(*conv->x_offset));
+    conv->row = malloc(size * sizeof(*conv->row));
+    conv->y = malloc((size_t)size * workers);
+    conv->u = malloc((size_t)size * workers);
+    conv->v = malloc((size_t)size * workers);
+    if (!conv->x_offset || !conv->row || !conv->y || !conv->u || !conv->v) {
+        perror("malloc");
+        free_tables(conv);
+        return -1;
+    }
+    if (shape_spans_init(&conv->spans, size) < 0) {
+        free_tables(conv);
+        return -1;
+    }
+    for (int i = 0; i < size; i++) {
+        int sample = (int)(((Sint64)2 * i + 1) * crop / (2 * size));
+        conv->x_offset[i] = sample * 2;
+        conv->row[i] = sample;
+    }
+    conv->size = size;
+    conv->crop = crop;
+    return 0;
+}
+
+int convert_yuyv(struct converter *conv, const Uint8 *data, int pitch, const SDL_Rect *crop, Uint32 *pixels,
+                 int dst_pitch, int size) {
+    if ((conv->size != size || conv->crop != crop->w) && build_tables(conv, size, crop->w) < 0) {
+        return -1;
+    }
+    const Uint8 *origin = data + (size_t)crop->y * pitch + (size_t)crop->x * 2;
+    row_fn row = current_kernel()->row;
+
+    // A band touches its output rows and about one source row per output
+    // row; keep that within CONVERT_BAND_BYTES
+    int band_rows = CONVERT_BAND_BYTES / (size * 4 + crop->w * 2);
+    if (band_rows < 1) band_rows = 1;
+    int bands = (size + band_rows - 1) / band_rows;
+    struct convert_pool *pool = conv->pool;
+    if (!pool || bands < 2) {
+        convert_rows(conv, row, 0, origin, pitch, pixels, dst_pitch, 0, size);
+        return 0;
+    }
+
+    SDL_LockMutex(pool->lock);
+    pool->origin = origin;
+    pool->pitch = pitch;
+    pool->pixels = pixels;
+    pool->dst_pitch = dst_pitch;
+    pool->row = row;
+    pool->band_rows = band_rows;
+    pool->bands = bands;
+    SDL_AtomicSet(&pool->next_band, 0);
+    pool->busy = pool->n_workers;
+    pool->generation++;
+    SDL_CondBroadcast(pool->start);
+    SDL_UnlockMutex(pool->lock);
+
+    convert_bands(pool, 0);
+
+    SDL_LockMutex(pool->lock);
+    while (pool->busy > 0) {
+        SDL_CondWait(pool->done, pool->lock);
+    }
+    SDL_UnlockMutex(pool->lock);
+    return 0;
+}
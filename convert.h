@@ -0,0 +1,57 @@
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include "cpu.h"
+#include "shape.h"
+#include <SDL2/SDL.h>
+
+// Software display path (-S): YUYV frames are cropped, scaled (nearest
+// neighbour), converted to RGB and masked to the circle in one pass over the
+// frame, straight into the window surface. No renderer or texture is
+// involved, which is what machines without a GPU want.
+
+#define CONVERT_MAX_THREADS 8
+#define CONVERT_BAND_BYTES (256 * 1024) // Output and source bytes per band of rows, sized to stay in L2
+
+struct convert_pool;
+
+// Tables for one window and crop size, rebuilt when either changes
+struct converter {
+    int size;         // Window size the tables are for
+    int crop;         // Crop size the tables are for
+    int *x_offset;    // Byte offset of each window column's Y sample within a crop row
+    int *row;         // Crop row of each window row
+    struct shape_spans spans; // Only these are converted; spans.rects bound what changed
+    Uint8 *y, *u, *v; // One window row of gathered samples per thread
+    struct convert_pool *pool; // Helper threads, see converter_start()
+};
+
+// The pixel kernel in use: "avx512bw", "avx2", "sse2", "neon" or "c". The
+// first conversion picks it from cpu_level() unless convert_use() did.
+const char *convert_kernel(void);
+
+// Use the best kernel for `level`. Returns the level of that kernel, or -1
+// when the CPU does not support `level`.
+int convert_use(enum cpu_level level);
+
+// Convert the `crop` square of a YUYV frame to a size x size XRGB8888 image
+// at `pixels`. Pixels outside the circle are left alone. Returns -1 on
+// allocation failure.
+int convert_yuyv(struct converter *conv, const Uint8 *data, int pitch, const SDL_Rect *crop, Uint32 *pixels,
+                 int dst_pitch, int size);
+
+// Split conversions into bands of rows shared by the caller and `threads` - 1
+// persistent helper threads. `threads` <= 0 picks one per CPU, up to
+// CONVERT_MAX_THREADS. Without it, or when it fails (-1), the caller converts
+// alone.
+int converter_start(struct converter *conv, int threads);
+
+// Stop the helper threads and free the tables
+void converter_free(struct converter *conv);
+
+// Convert `n` 4:4:4 samples to XRGB8888 (BT.601 limited range) with the
+// kernel in use. The benchmark compares each kernel with the portable C one.
+void convert_row(const Uint8 *y, const Uint8 *u, const Uint8 *v, Uint32 *out, int n);
+void convert_row_c(const Uint8 *y, const Uint8 *u, const Uint8 *v, Uint32 *out, int n);
+
+#endif
@@ -0,0 +1,89 @@
+#include "cpu.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *names[CPU_LEVELS] = { "c", "sse2", "ssse3", "avx2", "avx512bw", "neon" };
+
+const char *cpu_level_name(enum cpu_level level) {
+    return level < CPU_LEVELS ? names[level] : "?";
+}
+
+int cpu_parse_level(const char *s, enum cpu_level *level) {
+    for (int i = 0; i < CPU_LEVELS; i++) {
+        if (strcmp(s, names[i]) == 0) {
+            *level = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int cpu_supports(enum cpu_level level) {
+    switch (level) {
+    case CPU_C:
+        return 1;
+#if defined(__x86_64__) || defined(__i386__)
+    // libgcc checks XGETBV too, so AVX levels are off when the OS does not
+    // save the wider registers
+    case CPU_SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case CPU_SSSE3:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("ssse3");
+    case CPU_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    case CPU_AVX512BW:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512bw");
+#endif
+#if defined(__ARM_NEON)
+    case CPU_NEON:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+static enum cpu_level best_level(void) {
+    for (int i = CPU_LEVELS - 1; i > CPU_C; i--) {
+        if (cpu_supports(i)) {
+            return i;
+        }
+    }
+    return CPU_C;
+}
+
+enum cpu_level cpu_level(void) {
+    static int chosen = -1;
+    if (chosen >= 0) {
+        return chosen;
+    }
+    chosen = best_level();
+
+    const char *env = getenv(CPU_ENV);
+    enum cpu_level forced;
+    if (env && *env) {
+        if (cpu_parse_level(env, &forced) < 0) {
+            fprintf(stderr, "Ignoring %s=%s: unknown level\n", CPU_ENV, env);
+        } else if (!cpu_supports(forced)) {
+            fprintf(stderr, "Ignoring %s=%s: not supported by this CPU\n", CPU_ENV, env);
+        } else {
+            chosen = forced;
+        }
+    }
+    return chosen;
+}
+
+void cpu_print_features(FILE *out) {
+    fprintf(out, "supported:");
+    for (int i = 0; i < CPU_LEVELS; i++) {
+        if (cpu_supports(i)) {
+            fprintf(out, " %s", names[i]);
+        }
+    }
+    enum cpu_level level = cpu_level();
+    fprintf(out, "\nselected: %s%s\n", names[level], level != best_level() ? " (" CPU_ENV ")" : "");
+}
@@ -0,0 +1,36 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdio.h>
+
+#define CPU_ENV "CIRCAM_CPU" // Environment variable forcing a lower level, e.g. CIRCAM_CPU=sse2
+
+// Instruction set levels the pixel kernels can be built for. On x86 every
+// level is compiled into the binary and the best one the CPU supports is
+// picked at startup; NEON is a compile-time choice.
+enum cpu_level {
+    CPU_C,
+    CPU_SSE2,
+    CPU_SSSE3,
+    CPU_AVX2,
+    CPU_AVX512BW,
+    CPU_NEON,
+    CPU_LEVELS
+};
+
+const char *cpu_level_name(enum cpu_level level);
+
+// Parse a level name, returns -1 on error
+int cpu_parse_level(const char *s, enum cpu_level *level);
+
+// Whether this CPU (and OS, for the AVX register state) can run `level`
+int cpu_supports(enum cpu_level level);
+
+// The level kernels should use: the highest supported one, or CPU_ENV when
+// it names a supported level. Decided once.
+enum cpu_level cpu_level(void);
+
+// --cpu-features: the supported levels and the one in use
+void cpu_print_features(FILE *out);
+
+#endif
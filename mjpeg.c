@@ -0,0 +1,422 @@
+#include "mjpeg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+#define MAX_INFLIGHT (MJPEG_MAX_THREADS + 2)
+#define MAX_OUTPUTS (MAX_INFLIGHT + 2) // In flight, plus the renderer's and the pending triple buffer slot
+#define MAX_SCALE_DENOM 8
+
+// Size of one component's blocks after DCT scaling
+#if JPEG_LIB_VERSION >= 70
+#define DCT_ROWS(comp) ((comp)->DCT_v_scaled_size)
+#define DCT_COLS(comp) ((comp)->DCT_h_scaled_size)
+#else
+#define DCT_ROWS(comp) ((comp)->DCT_scaled_size)
+#define DCT_COLS(comp) ((comp)->DCT_scaled_size)
+#endif
+
+enum job_state { JOB_QUEUED, JOB_RUNNING, JOB_DONE };
+
+struct job {
+    int input;
+    const Uint8 *data;
+    size_t size;
+    Uint32 sequence;
+    Uint64 timestamp;
+    int output;
+    enum job_state state;
+    int ok;
+};
+
+// libjpeg error manager that longjmps out of a failed decode
+struct error_mgr {
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+struct worker {
+    struct mjpeg_pool *pool;
+    SDL_Thread *thread;
+    struct jpeg_decompress_struct cinfo;
+    struct error_mgr err;
+    Uint8 *scratch; // Rows libjpeg produces that the I420 output does not keep
+    Uint8 *chroma_rows[2][2 * DCTSIZE]; // Full-width chroma, see decode_raw()
+};
+
+struct mjpeg_pool {
+    int width, height;
+    struct mjpeg_callbacks cb;
+    SDL_atomic_t target_size;
+
+    SDL_mutex *lock;
+    SDL_cond *cond;
+    int stopping;
+
+    // Jobs in submission order
+    struct job jobs[MAX_INFLIGHT];
+    int head, count;
+
+    // Outputs hold only the rows of the square, at full frame width
+    Uint8 *memory[MAX_OUTPUTS];
+    struct mjpeg_image outputs[MAX_OUTPUTS];
+    int free_outputs[MAX_OUTPUTS];
+    int n_free;
+
+    struct worker workers[MJPEG_MAX_THREADS];
+    int n_workers;
+};
+
+static void error_exit(j_common_ptr cinfo) {
+    struct error_mgr *err = (struct error_mgr *)cinfo->err;
+    longjmp(err->jump, 1);
+}
+
+static void emit_message(j_common_ptr cinfo, int level) {
+    // UVC streams routinely carry minor corruption; stay quiet
+    (void)cinfo;
+    (void)level;
+}
+
+// Where the centered square lies in the (scaled) output
+struct square {
+    int x, y, size;
+};
+
+static struct square output_square(const struct jpeg_decompress_struct *cinfo) {
+    int w = cinfo->output_width, h = cinfo->output_height;
+    struct square sq;
+    sq.size = (w < h ? w : h) & ~1;
+    sq.x = ((w - sq.size) / 2) & ~1;
+    sq.y = ((h - sq.size) / 2) & ~1;
+    return sq;
+}
+
+// Decode straight from the native 4:2:2 or 4:2:0 planes, no colour conversion
+// or upsampling. 4:2:2 chroma drops every other row to become 4:2:0. Raw
+// output cannot be cropped by libjpeg, so rows above the square go to scratch
+// and decoding stops after its last row; columns are cropped by the plane
+// pointers in `img`. When DCT scaling makes libjpeg produce chroma at luma
+// width, it lands in chroma_rows and is decimated here.
+static void decode_raw(struct worker *w, struct mjpeg_image *img, Uint8 *const rows_base[3], struct square sq) {
+    struct jpeg_decompress_struct *cinfo = &w->cinfo;
+    jpeg_component_info *comp = cinfo->comp_info;
+    int rows = comp[0].v_samp_factor * DCT_ROWS(&comp[0]);
+    int chroma_rows = comp[1].v_samp_factor * DCT_ROWS(&comp[1]);
+    int chroma_step = rows / chroma_rows;
+    int full_chroma = comp[0].h_samp_factor * DCT_COLS(&comp[0]) == comp[1].h_samp_factor * DCT_COLS(&comp[1]);
+    JSAMPROW y_rows[2 * DCTSIZE], u_rows[2 * DCTSIZE], v_rows[2 * DCTSIZE];
+    JSAMPARRAY planes[3] = { y_rows, u_rows, v_rows };
+
+    while ((int)cinfo->output_scanline < sq.y + sq.size) {
+        int y0 = cinfo->output_scanline;
+        for (int r = 0; r < rows; r++) {
+            int row = y0 + r - sq.y;
+            y_rows[r] = row >= 0 && row < sq.size ? rows_base[0] + (size_t)row * img->pitches[0] : w->scratch;
+        }
+        for (int r = 0; r < chroma_rows; r++) {
+            int row = y0 + r * chroma_step - sq.y;
+            if (full_chroma) {
+                u_rows[r] = w->chroma_rows[0][r];
+                v_rows[r] = w->chroma_rows[1][r];
+            } else if (row >= 0 && row < sq.size && row % 2 == 0) {
+                u_rows[r] = rows_base[1] + (size_t)(row / 2) * img->pitches[1];
+                v_rows[r] = rows_base[2] + (size_t)(row / 2) * img->pitches[2];
+            } else {
+                u_rows[r] = v_rows[r] = w->scratch;
+            }
+        }
+        jpeg_read_raw_data(cinfo, planes, rows);
+        if (!full_chroma) {
+            continue;
+        }
+        for (int r = 0; r < chroma_rows; r++) {
+            int row = y0 + r * chroma_step - sq.y;
+            if (row < 0 || row >= sq.size || row % 2) {
+                continue;
+            }
+            Uint8 *dst_u = rows_base[1] + (size_t)(row / 2) * img->pitches[1] + sq.x / 2;
+            Uint8 *dst_v = rows_base[2] + (size_t)(row / 2) * img->pitches[2] + sq.x / 2;
+            const Uint8 *src_u = w->chroma_rows[0][r] + sq.x;
+            const Uint8 *src_v = w->chroma_rows[1][r] + sq.x;
+            for (int i = 0; i < sq.size / 2; i++) {
+                dst_u[i] = src_u[i * 2];
+                dst_v[i] = src_v[i * 2];
+            }
+        }
+    }
+}
+
+// Any other sampling: let libjpeg produce YCbCr scanlines of just the square
+// and subsample them
+static void decode_scanlines(struct worker *w, struct mjpeg_image *img, struct square sq) {
+    struct jpeg_decompress_struct *cinfo = &w->cinfo;
+    int gray = cinfo->out_color_space == JCS_GRAYSCALE;
+    int bpp = gray ? 1 : 3;
+    JDIMENSION x = sq.x, width = sq.size;
+    jpeg_crop_scanline(cinfo, &x, &width);
+    int dx = sq.x - (int)x;
+    if (sq.y > 0) {
+        jpeg_skip_scanlines(cinfo, sq.y);
+    }
+    for (int y = 0; y < sq.size; y++) {
+        JSAMPROW row = w->scratch;
+        jpeg_read_scanlines(cinfo, &row, 1);
+        const Uint8 *src = w->scratch + dx * bpp;
+        Uint8 *dst_y = img->planes[0] + (size_t)y * img->pitches[0];
+        Uint8 *dst_u = img->planes[1] + (size_t)(y / 2) * img->pitches[1];
+        Uint8 *dst_v = img->planes[2] + (size_t)(y / 2) * img->pitches[2];
+        if (gray) {
+            memcpy(dst_y, src, sq.size);
+            if (y % 2 == 0) {
+                memset(dst_u, 128, sq.size / 2);
+                memset(dst_v, 128, sq.size / 2);
+            }
+            continue;
+        }
+        for (int i = 0; i < sq.size; i++) {
+            dst_y[i] = src[i * 3];
+        }
+        if (y % 2 == 0) {
+            for (int i = 0; i < sq.size; i += 2) {
+                dst_u[i / 2] = src[i * 3 + 1];
+                dst_v[i / 2] = src[i * 3 + 2];
+            }
+        }
+    }
+}
+
+// Largest DCT scaling whose square still covers the target size
+static int scale_denom(int square, int target) {
+    int denom = 1;
+    while (denom < MAX_SCALE_DENOM && square / (denom * 2) >= target) {
+        denom *= 2;
+    }
+    return denom;
+}
+
+// Decode the centered square of one frame into output `output`. Returns 0 on success.
+static int decode(struct worker *w, const struct job *job, int output) {
+    struct mjpeg_pool *pool = w->pool;
+    struct jpeg_decompress_struct *cinfo = &w->cinfo;
+    struct mjpeg_image *img = &pool->outputs[output];
+    if (setjmp(w->err.jump)) {
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+    jpeg_mem_src(cinfo, job->data, job->size);
+    if (jpeg_read_header(cinfo, TRUE) != JPEG_HEADER_OK ||
+        (int)cinfo->image_width != pool->width || (int)cinfo->image_height != pool->height) {
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+    int square = (pool->width < pool->height ? pool->width : pool->height) & ~1;
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = scale_denom(square, SDL_AtomicGet(&pool->target_size));
+    cinfo->dct_method = JDCT_IFAST;
+    cinfo->do_fancy_upsampling = FALSE;
+
+    jpeg_component_info *comp = cinfo->comp_info;
+    int raw = cinfo->num_components == 3 && cinfo->jpeg_color_space == JCS_YCbCr &&
+              comp[0].h_samp_factor == 2 && (comp[0].v_samp_factor == 1 || comp[0].v_samp_factor == 2) &&
+              comp[1].h_samp_factor == 1 && comp[1].v_samp_factor == 1 &&
+              comp[2].h_samp_factor == 1 && comp[2].v_samp_factor == 1;
+    if (raw) {
+        cinfo->raw_data_out = TRUE;
+        cinfo->out_color_space = JCS_YCbCr;
+    } else {
+        cinfo->out_color_space = cinfo->num_components == 1 ? JCS_GRAYSCALE : JCS_YCbCr;
+    }
+    jpeg_start_decompress(cinfo);
+
+    struct square sq = output_square(cinfo);
+    Uint8 *rows_base[3] = {
+        pool->memory[output],
+        pool->memory[output] + (size_t)img->pitches[0] * square,
+        pool->memory[output] + (size_t)img->pitches[0] * square + (size_t)img->pitches[1] * (square / 2),
+    };
+    img->width = img->height = sq.size;
+    img->planes[0] = rows_base[0] + sq.x;
+    img->planes[1] = rows_base[1] + sq.x / 2;
+    img->planes[2] = rows_base[2] + sq.x / 2;
+    if (raw) {
+        decode_raw(w, img, rows_base, sq);
+    } else {
+        decode_scanlines(w, img, sq);
+    }
+
+    // The rows below the square are never needed
+    jpeg_abort_decompress(cinfo);
+    return 0;
+}
+
+// Hand finished jobs at the head of the queue to the owner, in order.
+// Called with the lock held.
+static void deliver(struct mjpeg_pool *pool) {
+    while (pool->count > 0 && pool->jobs[pool->head].state == JOB_DONE) {
+        struct job *job = &pool->jobs[pool->head];
+        int released = job->output;
+        if (job->ok) {
+            released = pool->cb.output_ready(pool->cb.ctx, job->output, job->sequence, job->timestamp);
+        }
+        if (released >= 0) {
+            pool->free_outputs[pool->n_free++] = released;
+        }
+        pool->head = (pool->head + 1) % MAX_INFLIGHT;
+        pool->count--;
+    }
+}
+
+static int worker_thread(void *data) {
+    struct worker *w = data;
+    struct mjpeg_pool *pool = w->pool;
+    SDL_LockMutex(pool->lock);
+    while (!pool->stopping) {
+        // Oldest queued job first
+        struct job *job = NULL;
+        for (int i = 0; i < pool->count; i++) {
+            struct job *j = &pool->jobs[(pool->head + i) % MAX_INFLIGHT];
+            if (j->state == JOB_QUEUED) {
+                job = j;
+                break;
+            }
+        }
+        if (!job) {
+            SDL_CondWait(pool->cond, pool->lock);
+            continue;
+        }
+        job->state = JOB_RUNNING;
+        SDL_UnlockMutex(pool->lock);
+
+        int ok = decode(w, job, job->output) == 0;
+        pool->cb.input_done(pool->cb.ctx, job->input);
+
+        SDL_LockMutex(pool->lock);
+        job->ok = ok;
+        job->state = JOB_DONE;
+        deliver(pool);
+    }
+    SDL_UnlockMutex(pool->lock);
+    return 0;
+}
+
+struct mjpeg_pool *mjpeg_create(int width, int height, int threads, const struct mjpeg_callbacks *cb) {
+    struct mjpeg_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->width = width;
+    pool->height = height;
+    pool->cb = *cb;
+    pool->lock = SDL_CreateMutex();
+    pool->cond = SDL_CreateCond();
+    if (!pool->lock || !pool->cond) {
+        mjpeg_destroy(pool);
+        return NULL;
+    }
+
+    // I420 outputs covering the rows of the square, padded to whole DCT
+    // blocks as libjpeg writes them
+    int y_pitch = (width + 15) & ~15;
+    int c_pitch = y_pitch / 2;
+    int square = (width < height ? width : height) & ~1;
+    for (int i = 0; i < MAX_OUTPUTS; i++) {
+        pool->memory[i] = malloc((size_t)y_pitch * square + (size_t)2 * c_pitch * (square / 2));
+        if (!pool->memory[i]) {
+            mjpeg_destroy(pool);
+            return NULL;
+        }
+        pool->outputs[i].pitches[0] = y_pitch;
+        pool->outputs[i].pitches[1] = pool->outputs[i].pitches[2] = c_pitch;
+        pool->free_outputs[pool->n_free++] = i;
+    }
+    SDL_AtomicSet(&pool->target_size, square);
+
+    if (threads <= 0) {
+        threads = SDL_GetCPUCount();
+    }
+    if (threads > MJPEG_MAX_THREADS) threads = MJPEG_MAX_THREADS;
+    if (threads < 1) threads = 1;
+    for (int i = 0; i < threads; i++) {
+        struct worker *w = &pool->workers[i];
+        w->pool = pool;
+        size_t row_size = (size_t)y_pitch + 16;
+        w->scratch = malloc(row_size * (3 + 2 * 2 * DCTSIZE));
+        for (int c = 0; c < 2; c++) {
+            for (int r = 0; w->scratch && r < 2 * DCTSIZE; r++) {
+                w->chroma_rows[c][r] = w->scratch + row_size * (3 + c * 2 * DCTSIZE + r);
+            }
+        }
+        w->cinfo.err = jpeg_std_error(&w->err.pub);
+        w->err.pub.error_exit = error_exit;
+        w->err.pub.emit_message = emit_message;
+        jpeg_create_decompress(&w->cinfo);
+        pool->n_workers++;
+        if (w->scratch) {
+            w->thread = SDL_CreateThread(worker_thread, "mjpeg", w);
+        }
+        if (!w->thread) {
+            mjpeg_destroy(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void mjpeg_destroy(struct mjpeg_pool *pool) {
+    if (!pool) {
+        return;
+    }
+    if (pool->lock) {
+        SDL_LockMutex(pool->lock);
+        pool->stopping = 1;
+        SDL_CondBroadcast(pool->cond);
+        SDL_UnlockMutex(pool->lock);
+    }
+    for (int i = 0; i < pool->n_workers; i++) {
+        struct worker *w = &pool->workers[i];
+        if (w->thread) {
+            SDL_WaitThread(w->thread, NULL);
+        }
+        jpeg_destroy_decompress(&w->cinfo);
+        free(w->scratch);
+    }
+    for (int i = 0; i < MAX_OUTPUTS; i++) {
+        free(pool->memory[i]);
+    }
+    if (pool->cond) SDL_DestroyCond(pool->cond);
+    if (pool->lock) SDL_DestroyMutex(pool->lock);
+    free(pool);
+}
+
+void mjpeg_set_target_size(struct mjpeg_pool *pool, int size) {
+    SDL_AtomicSet(&pool->target_size, size);
+}
+
+int mjpeg_submit(struct mjpeg_pool *pool, int input, const void *data, size_t size, Uint32 sequence, Uint64 timestamp) {
+    SDL_LockMutex(pool->lock);
+    if (pool->count == MAX_INFLIGHT || pool->n_free == 0) {
+        SDL_UnlockMutex(pool->lock);
+        return -1;
+    }
+    struct job *job = &pool->jobs[(pool->head + pool->count) % MAX_INFLIGHT];
+    CLEAR(*job);
+    job->input = input;
+    job->data = data;
+    job->size = size;
+    job->sequence = sequence;
+    job->timestamp = timestamp;
+    job->output = pool->free_outputs[--pool->n_free];
+    job->state = JOB_QUEUED;
+    pool->count++;
+    SDL_CondSignal(pool->cond);
+    SDL_UnlockMutex(pool->lock);
+    return 0;
+}
+
+const struct mjpeg_image *mjpeg_output(struct mjpeg_pool *pool, int output) {
+    return &pool->outputs[output];
+}
@@ -0,0 +1,48 @@
+#ifndef MJPEG_H
+#define MJPEG_H
+
+#include <SDL2/SDL.h>
+#include <stddef.h>
+
+#define MJPEG_MAX_THREADS 4
+
+// The decoded centered square of a frame, I420, possibly DCT-scaled
+struct mjpeg_image {
+    Uint8 *planes[3];
+    int pitches[3];
+    int width, height;
+};
+
+// How the pool hands buffers back to its owner
+struct mjpeg_callbacks {
+    // The compressed input buffer may be reused. Called from a worker.
+    void (*input_done)(void *ctx, int input);
+    // A decoded frame is ready; frames arrive in submission order. Called from
+    // a worker with the pool lock held. Returns an output the owner no longer
+    // references, which goes back to the pool, or -1.
+    int (*output_ready)(void *ctx, int output, Uint32 sequence, Uint64 timestamp);
+    void *ctx;
+};
+
+struct mjpeg_pool;
+
+// Start a decoder pool for width x height frames. `threads` <= 0 picks one
+// per CPU, up to MJPEG_MAX_THREADS.
+struct mjpeg_pool *mjpeg_create(int width, int height, int threads, const struct mjpeg_callbacks *cb);
+
+// Stop the workers and free all outputs. Pending inputs are not returned.
+void mjpeg_destroy(struct mjpeg_pool *pool);
+
+// Size of the window the frames are shown in. Frames are decoded with the
+// largest DCT scaling (1/2, 1/4, 1/8) that still covers it.
+void mjpeg_set_target_size(struct mjpeg_pool *pool, int size);
+
+// Queue a compressed frame. `sequence` and `timestamp` are passed through to
+// output_ready. Returns -1 without taking ownership of `input` when the
+// in-flight limit is reached.
+int mjpeg_submit(struct mjpeg_pool *pool, int input, const void *data, size_t size, Uint32 sequence, Uint64 timestamp);
+
+// Planes of a decoded output, valid until the output goes back to the pool
+const struct mjpeg_image *mjpeg_output(struct mjpeg_pool *pool, int output);
+
+#endif
@@ -0,0 +1,314 @@
+#include "negotiate.h"
+#include <sys/ioctl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+#define FALLBACK_WIDTH 640
+#define FALLBACK_HEIGHT 480
+#define BUS_WEIGHT 1.0  // Cost of one byte crossing USB relative to one unit of CPU cost
+#define CROP_ASPECT_TOLERANCE 0.02 // Max aspect mismatch between crop and frame before we call it stretched
+
+// Formats circam can display, in order of preference on equal score
+static const struct format_info formats[] = {
+    { V4L2_PIX_FMT_YUYV, SDL_PIXELFORMAT_YUY2, 16, 2, 0 },
+    { V4L2_PIX_FMT_UYVY, SDL_PIXELFORMAT_UYVY, 16, 2, 0 },
+    { V4L2_PIX_FMT_NV12, SDL_PIXELFORMAT_NV12, 12, 2, 0 },
+    { V4L2_PIX_FMT_MJPEG, SDL_PIXELFORMAT_IYUV, 3, 8, 1 },
+    { V4L2_PIX_FMT_JPEG, SDL_PIXELFORMAT_IYUV, 3, 8, 1 },
+};
+
+// Best candidate seen so far
+struct best {
+    struct negotiate_result mode;
+    double quality;
+    double cost;
+    int count;
+};
+
+const struct format_info *format_lookup(Uint32 fourcc) {
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (formats[i].fourcc == fourcc) {
+            return &formats[i];
+        }
+    }
+    return NULL;
+}
+
+Uint32 parse_fourcc(const char *s) {
+    size_t len = strlen(s);
+    if (len == 0 || len > 4) {
+        return 0;
+    }
+    char c[4] = { ' ', ' ', ' ', ' ' };
+    memcpy(c, s, len);
+    return v4l2_fourcc(c[0], c[1], c[2], c[3]);
+}
+
+// Score one (format, size, interval) candidate. Quality is how much of the
+// target size and frame rate the mode delivers (1.0 = all of it); among
+// equal quality the mode with the lowest bus plus CPU cost wins.
+static void consider(struct best *best, const struct negotiate_request *req, const struct format_info *info,
+                     int width, int height, struct v4l2_fract interval) {
+    if (req->width && (width != req->width || height != req->height)) {
+        return;
+    }
+    int target_fps = req->fps ? req->fps : DEFAULT_FPS;
+    double fps = interval.numerator && interval.denominator
+        ? (double)interval.denominator / interval.numerator : target_fps;
+    int short_side = width < height ? width : height;
+
+    double fps_quality = fps >= target_fps ? 1.0 : fps / target_fps;
+    double size_quality = short_side >= req->target_size ? 1.0 : (double)short_side / req->target_size;
+    double quality = fps_quality * size_quality;
+
+    // Compressed frames are decoded down to the bottom of the centered square
+    double processed = info->compressed ? (double)width * (height + short_side) / 2 : (double)short_side * short_side;
+    double cost = fps * ((double)width * height * info->bus_bits / 8 * BUS_WEIGHT + processed * info->cost);
+
+    best->count++;
+    if (best->count == 1 || quality > best->quality + 1e-6 ||
+        (quality > best->quality - 1e-6 && cost < best->cost)) {
+        best->mode.fourcc = info->fourcc;
+        best->mode.width = width;
+        best->mode.height = height;
+        best->mode.interval = interval;
+        best->quality = quality;
+        best->cost = cost;
+    }
+}
+
+// Enumerate the frame intervals of one size and consider each of them
+static void enum_intervals(int fd, struct best *best, const struct negotiate_request *req,
+                           const struct format_info *info, int width, int height) {
+    struct v4l2_frmivalenum ival;
+    CLEAR(ival);
+    ival.pixel_format = info->fourcc;
+    ival.width = width;
+    ival.height = height;
+    if (ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) < 0) {
+        // Interval unknown: assume the driver can do the target rate
+        consider(best, req, info, width, height, (struct v4l2_fract){ 0, 0 });
+        return;
+    }
+    if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+        do {
+            consider(best, req, info, width, height, ival.discrete);
+            ival.index++;
+        } while (ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) == 0);
+        return;
+    }
+
+    // Stepwise or continuous: the fastest rate, and the target rate if in range
+    struct v4l2_fract fastest = ival.stepwise.min;
+    consider(best, req, info, width, height, fastest);
+    int target_fps = req->fps ? req->fps : DEFAULT_FPS;
+    double min_s = (double)ival.stepwise.min.numerator / ival.stepwise.min.denominator;
+    double max_s = (double)ival.stepwise.max.numerator / ival.stepwise.max.denominator;
+    double target_s = 1.0 / target_fps;
+    if (target_s > min_s && target_s <= max_s) {
+        consider(best, req, info, width, height, (struct v4l2_fract){ 1, target_fps });
+    }
+}
+
+// Round `value` up to `min + k * step`, clamped to [min, max]
+static int step_up(int value, int min, int max, int step) {
+    if (value <= min) return min;
+    if (value >= max) return max;
+    if (step <= 1) return value;
+    return min + (value - min + step - 1) / step * step;
+}
+
+// Enumerate the frame sizes of one format
+static void enum_sizes(int fd, struct best *best, const struct negotiate_request *req, const struct format_info *info) {
+    struct v4l2_frmsizeenum size;
+    CLEAR(size);
+    size.pixel_format = info->fourcc;
+    if (ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &size) < 0) {
+        return;
+    }
+    if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+        do {
+            enum_intervals(fd, best, req, info, size.discrete.width, size.discrete.height);
+            size.index++;
+        } while (ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &size) == 0);
+        return;
+    }
+
+    // Stepwise or continuous: the override, or the smallest size whose short
+    // side covers the target (keeping the maximum size's aspect), and the maximum
+    struct v4l2_frmsize_stepwise *sw = &size.stepwise;
+    int width, height;
+    if (req->width) {
+        width = req->width;
+        height = req->height;
+    } else if (sw->max_width >= sw->max_height) {
+        height = step_up(req->target_size, sw->min_height, sw->max_height, sw->step_height);
+        width = step_up((int)((double)height * sw->max_width / sw->max_height), sw->min_width, sw->max_width, sw->step_width);
+    } else {
+        width = step_up(req->target_size, sw->min_width, sw->max_width, sw->step_width);
+        height = step_up((int)((double)width * sw->max_height / sw->max_width), sw->min_height, sw->max_height, sw->step_height);
+    }
+    enum_intervals(fd, best, req, info, width, height);
+    if (width != (int)sw->max_width || height != (int)sw->max_height) {
+        enum_intervals(fd, best, req, info, sw->max_width, sw->max_height);
+    }
+}
+
+int negotiate_format(int fd, const struct negotiate_request *req, struct negotiate_result *out) {
+    struct best best;
+    CLEAR(best);
+
+    struct v4l2_fmtdesc desc;
+    CLEAR(desc);
+    desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    while (ioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0) {
+        const struct format_info *info = format_lookup(desc.pixelformat);
+        if (info && (!req->fourcc || req->fourcc == info->fourcc)) {
+            enum_sizes(fd, &best, req, info);
+        }
+        desc.index++;
+    }
+
+    if (best.count == 0) {
+        // Nothing usable enumerated: let S_FMT adjust the overrides
+        CLEAR(*out);
+        out->fourcc = req->fourcc ? req->fourcc : V4L2_PIX_FMT_YUYV;
+        out->width = req->width ? req->width : FALLBACK_WIDTH;
+        out->height = req->height ? req->height : FALLBACK_HEIGHT;
+        if (req->fps) {
+            out->interval = (struct v4l2_fract){ 1, req->fps };
+        }
+        return 0;
+    }
+    *out = best.mode;
+    return best.count;
+}
+
+// Frame rate is best effort: many drivers do not support S_PARM
+static void set_interval(int fd, struct v4l2_fract interval) {
+    if (!interval.numerator || !interval.denominator) {
+        return;
+    }
+    struct v4l2_streamparm parm;
+    CLEAR(parm);
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (ioctl(fd, VIDIOC_G_PARM, &parm) == 0 && (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME)) {
+        parm.parm.capture.timeperframe = interval;
+        if (ioctl(fd, VIDIOC_S_PARM, &parm) < 0 && errno != ENOTTY) {
+            perror("VIDIOC_S_PARM");
+        }
+    }
+}
+
+int apply_format(int fd, const struct negotiate_result *mode, struct v4l2_format *fmt) {
+    CLEAR(*fmt);
+    fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt->fmt.pix.width = mode->width;
+    fmt->fmt.pix.height = mode->height;
+    fmt->fmt.pix.pixelformat = mode->fourcc;
+    fmt->fmt.pix.field = V4L2_FIELD_ANY;
+    if (ioctl(fd, VIDIOC_S_FMT, fmt) < 0) {
+        perror("VIDIOC_S_FMT");
+        return -1;
+    }
+    if (!format_lookup(fmt->fmt.pix.pixelformat)) {
+        Uint32 f = fmt->fmt.pix.pixelformat;
+        fprintf(stderr, "Driver selected unsupported pixel format %c%c%c%c\n",
+                f & 0xFF, (f >> 8) & 0xFF, (f >> 16) & 0xFF, (f >> 24) & 0xFF);
+        return -1;
+    }
+    set_interval(fd, mode->interval);
+    return 0;
+}
+
+// Set the crop rectangle with the selection API, or the older crop API
+static int set_crop(int fd, int use_selection, struct v4l2_rect *rect) {
+    if (use_selection) {
+        struct v4l2_selection sel;
+        CLEAR(sel);
+        sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        sel.target = V4L2_SEL_TGT_CROP;
+        sel.r = *rect;
+        if (ioctl(fd, VIDIOC_S_SELECTION, &sel) < 0) {
+            return -1;
+        }
+        *rect = sel.r;
+        return 0;
+    }
+    struct v4l2_crop crop;
+    CLEAR(crop);
+    crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    crop.c = *rect;
+    if (ioctl(fd, VIDIOC_S_CROP, &crop) < 0 || ioctl(fd, VIDIOC_G_CROP, &crop) < 0) {
+        return -1;
+    }
+    *rect = crop.c;
+    return 0;
+}
+
+int request_square_crop(int fd, const struct negotiate_result *mode, struct v4l2_format *fmt) {
+    // The default crop rectangle is the picture the user would otherwise see
+    struct v4l2_rect area;
+    struct v4l2_selection sel;
+    CLEAR(sel);
+    sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    sel.target = V4L2_SEL_TGT_CROP_DEFAULT;
+    int use_selection = ioctl(fd, VIDIOC_G_SELECTION, &sel) == 0;
+    if (use_selection) {
+        area = sel.r;
+    } else {
+        struct v4l2_cropcap cropcap;
+        CLEAR(cropcap);
+        cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if (ioctl(fd, VIDIOC_CROPCAP, &cropcap) < 0) {
+            return 0;
+        }
+        area = cropcap.defrect;
+    }
+    if (area.width == area.height || area.width == 0 || area.height == 0) {
+        return 0;
+    }
+
+    unsigned int side = area.width < area.height ? area.width : area.height;
+    struct v4l2_rect square = {
+        .left = area.left + (int)(area.width - side) / 2,
+        .top = area.top + (int)(area.height - side) / 2,
+        .width = side,
+        .height = side,
+    };
+    if (set_crop(fd, use_selection, &square) < 0) {
+        return 0;
+    }
+
+    // Ask for a square frame from the cropped area. Drivers that scale the
+    // crop to the old frame size would stretch the picture: undo in that case.
+    struct v4l2_format square_fmt = *fmt;
+    unsigned int frame_side = fmt->fmt.pix.width < fmt->fmt.pix.height ? fmt->fmt.pix.width : fmt->fmt.pix.height;
+    square_fmt.fmt.pix.width = frame_side;
+    square_fmt.fmt.pix.height = frame_side;
+    square_fmt.fmt.pix.bytesperline = 0;
+    square_fmt.fmt.pix.sizeimage = 0;
+    if (ioctl(fd, VIDIOC_S_FMT, &square_fmt) == 0 &&
+        square_fmt.fmt.pix.pixelformat == fmt->fmt.pix.pixelformat && square.width && square.height) {
+        double frame_aspect = (double)square_fmt.fmt.pix.width / square_fmt.fmt.pix.height;
+        double crop_aspect = (double)square.width / square.height;
+        int square_crop = crop_aspect < 1 + CROP_ASPECT_TOLERANCE && 1 / crop_aspect < 1 + CROP_ASPECT_TOLERANCE;
+        int unstretched = frame_aspect / crop_aspect < 1 + CROP_ASPECT_TOLERANCE &&
+                          crop_aspect / frame_aspect < 1 + CROP_ASPECT_TOLERANCE;
+        if (square_crop && unstretched) {
+            *fmt = square_fmt;
+            set_interval(fd, mode->interval);
+            return 1;
+        }
+    }
+
+    set_crop(fd, use_selection, &area);
+    struct v4l2_format restore = *fmt;
+    if (ioctl(fd, VIDIOC_S_FMT, &restore) == 0) {
+        *fmt = restore;
+    }
+    set_interval(fd, mode->interval);
+    return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef NEGOTIATE_H
+#define NEGOTIATE_H
+
+#include <SDL2/SDL.h>
+#include <linux/videodev2.h>
+
+#define DEFAULT_FPS 30
+
+// A capture pixel format circam knows how to get on screen
+struct format_info {
+    Uint32 fourcc;      // V4L2 pixel format
+    Uint32 sdl_format;  // Texture format frames are uploaded as
+    int bus_bits;       // Bits per pixel on the bus (estimated for compressed formats)
+    int cost;           // Relative CPU cost per processed pixel
+    int compressed;     // Frames are decoded row by row, not just the crop
+};
+
+// What the caller wants; zero fields mean "pick automatically"
+struct negotiate_request {
+    int target_size;    // Window size the crop has to fill
+    int width, height;  // -r override
+    int fps;            // -f override, DEFAULT_FPS when 0
+    Uint32 fourcc;      // -F override
+};
+
+// The chosen capture mode
+struct negotiate_result {
+    Uint32 fourcc;
+    int width, height;
+    struct v4l2_fract interval; // Time per frame, 0/0 when unknown
+};
+
+// Look up a supported pixel format, NULL if circam cannot display it
+const struct format_info *format_lookup(Uint32 fourcc);
+
+// Parse a fourcc such as "YUYV" or "MJPG", returns 0 on error
+Uint32 parse_fourcc(const char *s);
+
+// Enumerate formats, frame sizes and frame intervals of the device and pick
+// the cheapest mode that fills the request. Falls back to the overrides (or
+// YUYV 640x480) when the driver cannot enumerate anything usable, so it
+// always fills `out`. Returns the number of candidates considered.
+int negotiate_format(int fd, const struct negotiate_request *req, struct negotiate_result *out);
+
+// Apply a negotiated mode with VIDIOC_S_FMT and VIDIOC_S_PARM. `fmt` receives
+// what the driver actually set. Returns -1 if S_FMT fails or the driver
+// switched to a format circam cannot display.
+int apply_format(int fd, const struct negotiate_result *mode, struct v4l2_format *fmt);
+
+// Ask the driver to crop the centered square of the sensor area
+// (VIDIOC_S_SELECTION, or VIDIOC_S_CROP on older drivers) and deliver square
+// frames. Returns 1 and updates `fmt` on success. Returns 0 with the original
+// crop and format restored when the driver refuses or would stretch the
+// picture; the caller then crops in software.
+int request_square_crop(int fd, const struct negotiate_result *mode, struct v4l2_format *fmt);
+
+#endif
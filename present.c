@@ -0,0 +1,59 @@
+#include "present.h"
+#include <string.h>
+#include <time.h>
+
+static Uint64 now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int present_parse_policy(const char *s, enum present_policy *policy) {
+    if (strcmp(s, "latency") == 0) {
+        *policy = PRESENT_LATENCY;
+    } else if (strcmp(s, "smooth") == 0) {
+        *policy = PRESENT_SMOOTH;
+    } else if (strcmp(s, "vsync") == 0) {
+        *policy = PRESENT_VSYNC;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+Uint32 present_renderer_flags(enum present_policy policy) {
+    return policy == PRESENT_VSYNC ? SDL_RENDERER_PRESENTVSYNC : 0;
+}
+
+void scheduler_init(struct scheduler *sched, enum present_policy policy, int refresh_rate) {
+    sched->policy = policy;
+    sched->refresh_us = 1000000 / (refresh_rate > 0 ? refresh_rate : PRESENT_DEFAULT_HZ);
+    sched->delay_us = 0;
+}
+
+// Smooth presentation holds every frame until a fixed time after its capture,
+// so uneven arrival (USB bursts, decoder threads, wakeup latency) does not
+// reach the screen. The delay follows the worst recent arrival at once and
+// relaxes slowly, plus half a refresh period so a frame is not shown one
+// refresh early or late depending on where its deadline falls.
+Uint64 scheduler_due(struct scheduler *sched, Uint64 timestamp) {
+    Uint64 now = now_us();
+    if (sched->policy != PRESENT_SMOOTH || !timestamp || timestamp > now) {
+        return now;
+    }
+    Uint64 lateness = now - timestamp;
+    if (lateness > PRESENT_MAX_DELAY_US) {
+        return now;
+    }
+    if (lateness > sched->delay_us) {
+        sched->delay_us = lateness;
+    } else {
+        sched->delay_us -= (sched->delay_us - lateness) / PRESENT_DECAY;
+    }
+    return timestamp + sched->delay_us + sched->refresh_us / 2;
+}
+
+int scheduler_timeout(Uint64 due) {
+    Uint64 now = now_us();
+    return now >= due ? 0 : (int)((due - now + 999) / 1000);
+}
@@ -0,0 +1,39 @@
+#ifndef PRESENT_H
+#define PRESENT_H
+
+#include <SDL2/SDL.h>
+
+#define PRESENT_DEFAULT_HZ 60 // Assumed refresh rate when the display does not report one
+#define PRESENT_MAX_DELAY_US 100000 // Frames later than this are shown at once and do not grow the jitter buffer
+#define PRESENT_DECAY 64 // The jitter buffer shrinks by 1/PRESENT_DECAY of its slack per frame
+
+// When a new frame goes on screen
+enum present_policy {
+    PRESENT_LATENCY, // As soon as it arrives
+    PRESENT_SMOOTH,  // A constant delay after its capture timestamp, so frames keep the camera's cadence
+    PRESENT_VSYNC,   // As soon as it arrives, with SDL_RENDERER_PRESENTVSYNC
+};
+
+struct scheduler {
+    enum present_policy policy;
+    Uint64 refresh_us; // Display refresh period
+    Uint64 delay_us;   // Smooth: capture to present delay covering the recent arrival jitter
+};
+
+// Parse "latency", "smooth" or "vsync", returns -1 on error
+int present_parse_policy(const char *s, enum present_policy *policy);
+
+// Extra SDL_CreateRenderer flags the policy needs
+Uint32 present_renderer_flags(enum present_policy policy);
+
+// `refresh_rate` in Hz, 0 when unknown
+void scheduler_init(struct scheduler *sched, enum present_policy policy, int refresh_rate);
+
+// A new frame with capture `timestamp` (CLOCK_MONOTONIC microseconds, 0 when
+// unknown) arrived. Returns when to show it on the same clock.
+Uint64 scheduler_due(struct scheduler *sched, Uint64 timestamp);
+
+// Milliseconds until `due`, rounded up; 0 once it has passed
+int scheduler_timeout(Uint64 due);
+
+#endif
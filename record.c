@@ -0,0 +1,79 @@
+#include "record.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+#define WRITE_BUFFER (1 << 20)
+
+struct recorder {
+    FILE *file;
+    int failed;
+};
+
+struct recorder *recorder_open(const char *path, const struct source_format *fmt, struct v4l2_fract interval) {
+    struct recorder *rec = calloc(1, sizeof(*rec));
+    if (!rec) {
+        perror("calloc");
+        return NULL;
+    }
+    rec->file = fopen(path, "wb");
+    if (!rec->file) {
+        perror("Cannot create recording");
+        free(rec);
+        return NULL;
+    }
+    setvbuf(rec->file, NULL, _IOFBF, WRITE_BUFFER);
+
+    struct recording_header header;
+    CLEAR(header);
+    memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+    header.fourcc = fmt->fourcc;
+    header.width = fmt->width;
+    header.height = fmt->height;
+    header.pitch = fmt->pitch;
+    header.hardware_crop = fmt->hardware_crop;
+    header.interval_numerator = interval.numerator;
+    header.interval_denominator = interval.denominator;
+    if (fwrite(&header, sizeof(header), 1, rec->file) != 1) {
+        perror("Cannot write recording");
+        fclose(rec->file);
+        free(rec);
+        return NULL;
+    }
+    return rec;
+}
+
+int recorder_frame(struct recorder *rec, const struct source_frame *frame) {
+    static const Uint8 padding[RECORDING_ALIGN];
+    if (rec->failed) {
+        return -1;
+    }
+    struct recording_frame record;
+    CLEAR(record);
+    record.timestamp = frame->timestamp;
+    record.sequence = frame->sequence;
+    record.bytesused = (Uint32)frame->bytesused;
+    size_t pad = (RECORDING_ALIGN - frame->bytesused % RECORDING_ALIGN) % RECORDING_ALIGN;
+    if (fwrite(&record, sizeof(record), 1, rec->file) != 1 ||
+        fwrite(frame->data, 1, frame->bytesused, rec->file) != frame->bytesused ||
+        fwrite(padding, 1, pad, rec->file) != pad) {
+        perror("Cannot write recording");
+        rec->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+int recorder_close(struct recorder *rec) {
+    if (!rec) {
+        return 0;
+    }
+    int failed = rec->failed;
+    if (fclose(rec->file) != 0) {
+        perror("Cannot write recording");
+        failed = 1;
+    }
+    free(rec);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,40 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <SDL2/SDL.h>
+#include "source.h"
+
+// Capture recordings: a header describing the stream, then one record per
+// dequeued frame with its data, each padded to 8 bytes so the file can be
+// mapped and read in place. Fields are in host byte order.
+#define RECORDING_MAGIC "CIRCAMR1"
+#define RECORDING_ALIGN 8
+
+struct recording_header {
+    char magic[8];
+    Uint32 fourcc;
+    Sint32 width, height;
+    Sint32 pitch;
+    Uint32 hardware_crop;
+    Uint32 interval_numerator, interval_denominator; // Negotiated time per frame, 0/0 when unknown
+    Uint32 reserved;
+};
+
+struct recording_frame {
+    Uint64 timestamp; // Capture time in microseconds, 0 when unknown
+    Uint32 sequence;
+    Uint32 bytesused; // Data bytes following this record
+};
+
+struct recorder;
+
+// Create a recording of a stream in `fmt`. Returns NULL on failure.
+struct recorder *recorder_open(const char *path, const struct source_format *fmt, struct v4l2_fract interval);
+
+// Append a dequeued frame. Returns -1 on write errors.
+int recorder_frame(struct recorder *rec, const struct source_frame *frame);
+
+// Flush and close. Returns -1 if anything failed to reach the file.
+int recorder_close(struct recorder *rec);
+
+#endif
@@ -0,0 +1,150 @@
+#include "shape.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MASK_BYTES(size) ((size_t)(size) * (size) * 4)
+
+// Largest h with h * h <= n
+static int isqrt(int n) {
+    int h = (int)sqrt((double)n);
+    while (h * h > n) h--;
+    while ((h + 1) * (h + 1) <= n) h++;
+    return h;
+}
+
+// Write one mask row: transparent, then `span` opaque pixels from `x0`, then
+// transparent up to the end of the row
+static void fill_row(Uint32 *row, int size, int x0, int span, Uint32 white) {
+    if (x0 > 0) SDL_memset4(row, 0, x0);
+    if (span > 0) SDL_memset4(row + x0, white, span);
+    if (x0 + span < size) SDL_memset4(row + x0 + span, 0, size - x0 - span);
+}
+
+// Pixel (x, y) is inside when (x - center)^2 + (y - center)^2 <= radius^2,
+// so each row is a single span
+void shape_span(int size, int row, int *x0, int *x1) {
+    int center = size / 2;
+    int dy = row - center;
+    if (dy < -center || dy > center) {
+        *x0 = *x1 = 0;
+        return;
+    }
+    int half = isqrt(center * center - dy * dy);
+    *x0 = center - half;
+    *x1 = (center + half < size - 1 ? center + half : size - 1) + 1;
+}
+
+int shape_spans_init(struct shape_spans *spans, int size) {
+    shape_spans_free(spans);
+    spans->x0 = malloc(size * sizeof(*spans->x0));
+    spans->x1 = malloc(size * sizeof(*spans->x1));
+    if (!spans->x0 || !spans->x1) {
+        perror("malloc");
+        shape_spans_free(spans);
+        return -1;
+    }
+    for (int y = 0; y < size; y++) {
+        shape_span(size, y, &spans->x0[y], &spans->x1[y]);
+    }
+    spans->size = size;
+
+    // Equal bands of rows, each bounded by its widest span. Bands next to
+    // the center are nearly square; those at the top and bottom are short
+    // and narrow, so 16 bands leave little of the corners in.
+    int band = (size + SHAPE_RECTS - 1) / SHAPE_RECTS;
+    for (int y0 = 0; y0 < size; y0 += band) {
+        int y1 = y0 + band < size ? y0 + band : size;
+        int left = size, right = 0;
+        for (int y = y0; y < y1; y++) {
+            if (spans->x0[y] < spans->x1[y]) {
+                if (spans->x0[y] < left) left = spans->x0[y];
+                if (spans->x1[y] > right) right = spans->x1[y];
+            }
+        }
+        if (left < right) {
+            spans->rects[spans->n_rects++] = (SDL_Rect){ left, y0, right - left, y1 - y0 };
+        }
+    }
+    return 0;
+}
+
+void shape_spans_free(struct shape_spans *spans) {
+    free(spans->x0);
+    free(spans->x1);
+    memset(spans, 0, sizeof(*spans));
+}
+
+SDL_Surface *shape_create(int size) {
+    SDL_Surface *surface = SDL_CreateRGBSurface(0, size, size, 32, 0xFF0000, 0xFF00, 0xFF, 0xFF000000);
+    if (!surface) {
+        fprintf(stderr, "SDL_CreateRGBSurface failed: %s\n", SDL_GetError());
+        return NULL;
+    }
+    Uint32 white = SDL_MapRGBA(surface->format, 255, 255, 255, 255);
+    Uint8 *pixels = surface->pixels;
+
+    // Rows center - dy and center + dy share a span, so each is computed
+    // once. Every row is written in full, transparent parts included.
+    int center = size / 2;
+    for (int dy = 0; dy <= center; dy++) {
+        int x0, x1;
+        shape_span(size, center - dy, &x0, &x1);
+        int rows[2] = { center - dy, center + dy };
+        for (int i = 0; i < (dy ? 2 : 1); i++) {
+            if (rows[i] < size) {
+                fill_row((Uint32 *)(pixels + rows[i] * surface->pitch), size, x0, x1 - x0, white);
+            }
+        }
+    }
+    return surface;
+}
+
+SDL_Surface *shape_cache_get(struct shape_cache *cache, int size) {
+    cache->clock++;
+    size_t bytes = MASK_BYTES(size);
+    for (int i = 0; i < SHAPE_CACHE_ENTRIES; i++) {
+        if (cache->entries[i].surface && cache->entries[i].size == size) {
+            cache->entries[i].last_used = cache->clock;
+            return cache->entries[i].surface;
+        }
+    }
+
+    // Evict least recently used masks until there is a free entry and the
+    // new mask fits the memory budget
+    for (;;) {
+        size_t used = 0;
+        int free_slot = -1, oldest = -1;
+        for (int i = 0; i < SHAPE_CACHE_ENTRIES; i++) {
+            if (!cache->entries[i].surface) {
+                free_slot = i;
+                continue;
+            }
+            used += MASK_BYTES(cache->entries[i].size);
+            if (oldest < 0 || cache->entries[i].last_used < cache->entries[oldest].last_used) {
+                oldest = i;
+            }
+        }
+        if (free_slot >= 0 && (used + bytes <= SHAPE_CACHE_BYTES || oldest < 0)) {
+            SDL_Surface *surface = shape_create(size);
+            if (surface) {
+                cache->entries[free_slot].size = size;
+                cache->entries[free_slot].last_used = cache->clock;
+                cache->entries[free_slot].surface = surface;
+            }
+            return surface;
+        }
+        SDL_FreeSurface(cache->entries[oldest].surface);
+        cache->entries[oldest].surface = NULL;
+    }
+}
+
+void shape_cache_free(struct shape_cache *cache) {
+    for (int i = 0; i < SHAPE_CACHE_ENTRIES; i++) {
+        if (cache->entries[i].surface) {
+            SDL_FreeSurface(cache->entries[i].surface);
+            cache->entries[i].surface = NULL;
+        }
+    }
+}
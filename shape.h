@@ -0,0 +1,51 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#include <SDL2/SDL.h>
+
+#define SHAPE_CACHE_ENTRIES 16
+#define SHAPE_CACHE_BYTES (64 << 20) // Evict older masks beyond this much pixel memory
+#define SHAPE_RECTS 16 // Bands of rows the circle's bounding rectangles cover
+
+// Columns [x0, x1) of `row` that lie inside the circle of a size x size
+// window; x0 == x1 when none do
+void shape_span(int size, int row, int *x0, int *x1);
+
+// The span of every row of a size x size window, for software stages that
+// should skip pixels outside the circle, and rectangles around bands of rows
+// covering all spans, for updating only those parts of a window
+struct shape_spans {
+    int size;
+    int *x0, *x1; // Columns [x0[y], x1[y]) of row y are inside
+    SDL_Rect rects[SHAPE_RECTS];
+    int n_rects;
+};
+
+// Build the table for `size` (freeing any previous one). Returns -1 on
+// allocation failure.
+int shape_spans_init(struct shape_spans *spans, int size);
+
+void shape_spans_free(struct shape_spans *spans);
+
+// Build a size x size ARGB mask, opaque white inside the circle and
+// transparent outside. Returns NULL on allocation failure.
+SDL_Surface *shape_create(int size);
+
+// Recently used masks, keyed by size
+struct shape_cache {
+    struct {
+        int size;
+        Uint32 last_used;
+        SDL_Surface *surface;
+    } entries[SHAPE_CACHE_ENTRIES];
+    Uint32 clock;
+};
+
+// Return the mask for `size`, building it on a miss and evicting the least
+// recently used masks to make room. The cache keeps ownership; the surface is
+// valid until the next shape_cache_get() or shape_cache_free().
+SDL_Surface *shape_cache_get(struct shape_cache *cache, int size);
+
+void shape_cache_free(struct shape_cache *cache);
+
+#endif
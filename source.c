@@ -0,0 +1,45 @@
+#include "source.h"
+#include <sys/stat.h>
+#include <string.h>
+
+struct source *source_open(const char *device, int flags, int buffers) {
+    struct source *src;
+    struct stat st;
+    if (strcmp(device, SYNTHETIC_DEVICE) == 0) {
+        src = source_synthetic_open(flags & SOURCE_STAMP_TIME);
+    } else if (stat(device, &st) == 0 && S_ISREG(st.st_mode)) {
+        src = source_replay_open(device, flags & SOURCE_REPLAY_FAST);
+    } else {
+        src = source_v4l2_open(device);
+    }
+    if (src) {
+        src->buffers = buffers;
+    }
+    return src;
+}
+
+void source_close(struct source *src) {
+    if (src) {
+        src->ops->close(src);
+    }
+}
+
+void source_negotiate(struct source *src, const struct negotiate_request *req, struct negotiate_result *out) {
+    src->ops->negotiate(src, req, out);
+}
+
+int source_start(struct source *src, const struct negotiate_result *mode, struct source_format *fmt) {
+    return src->ops->start(src, mode, fmt);
+}
+
+void source_stop(struct source *src) {
+    src->ops->stop(src);
+}
+
+int source_dequeue(struct source *src, struct source_frame *frame) {
+    return src->ops->dequeue(src, frame);
+}
+
+void source_requeue(struct source *src, int index) {
+    src->ops->requeue(src, index);
+}
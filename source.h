@@ -0,0 +1,82 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <SDL2/SDL.h>
+#include <stddef.h>
+#include "negotiate.h"
+
+#define SOURCE_DEFAULT_BUFFERS 4 // Buffers per stream unless -b asks for another count
+#define SOURCE_MAX_BUFFERS 32 // VIDEO_MAX_FRAME
+#define SOURCE_RAW_MIN_BUFFERS 3 // Raw frames hold the front and middle slots, so the driver needs one more
+#define SYNTHETIC_DEVICE "synthetic" // Device name that selects the test pattern source
+#define SOURCE_REPLAY_FAST 1 // source_open() flag: replay recordings without their timing
+#define SOURCE_STAMP_TIME 2  // source_open() flag: the synthetic source draws a time stamp into each frame (stamp.h)
+
+// One dequeued frame. The buffer belongs to the caller until source_requeue().
+struct source_frame {
+    int index;
+    const Uint8 *data;
+    size_t bytesused;
+    Uint32 sequence;   // Gaps mean the source dropped frames
+    Uint64 timestamp;  // Capture time in microseconds (CLOCK_MONOTONIC), 0 when unknown
+};
+
+// What a started stream delivers
+struct source_format {
+    Uint32 fourcc;
+    int width, height;
+    int pitch;         // Bytes per line (of the Y plane for NV12)
+    int hardware_crop; // The source already cropped the centered square
+};
+
+struct source;
+
+// Backend operations. Each backend embeds struct source at the start of its
+// own state.
+struct source_ops {
+    const char *name;
+    void (*close)(struct source *src);
+    void (*negotiate)(struct source *src, const struct negotiate_request *req, struct negotiate_result *out);
+    int (*start)(struct source *src, const struct negotiate_result *mode, struct source_format *fmt);
+    void (*stop)(struct source *src);
+    int (*dequeue)(struct source *src, struct source_frame *frame);
+    void (*requeue)(struct source *src, int index);
+};
+
+struct source {
+    const struct source_ops *ops;
+    int fd; // Becomes readable (POLLIN) when a frame can be dequeued
+    int buffers; // Buffers to allocate per stream, at most SOURCE_MAX_BUFFERS
+};
+
+// Open a capture source: SYNTHETIC_DEVICE for the test pattern, a regular
+// file for a recording made with --record, anything else is a V4L2 device
+// node. Streams use `buffers` buffers (drivers may adjust a V4L2 request).
+// Returns NULL after printing the error.
+struct source *source_open(const char *device, int flags, int buffers);
+void source_close(struct source *src);
+
+// Pick the cheapest mode that fills the request. Always fills `out`.
+void source_negotiate(struct source *src, const struct negotiate_request *req, struct negotiate_result *out);
+
+// Configure `mode`, allocate and queue buffers and start streaming. `fmt`
+// receives what the source actually delivers. Returns -1 with nothing left
+// allocated on failure.
+int source_start(struct source *src, const struct negotiate_result *mode, struct source_format *fmt);
+
+// Stop streaming and free the buffers. Safe to call when not streaming.
+void source_stop(struct source *src);
+
+// Take the next ready frame without blocking. Returns -1 when there is none
+// (errors other than that are printed).
+int source_dequeue(struct source *src, struct source_frame *frame);
+
+// Hand a buffer back. May be called from any thread.
+void source_requeue(struct source *src, int index);
+
+// Backends
+struct source *source_v4l2_open(const char *device);
+struct source *source_synthetic_open(int stamp);
+struct source *source_replay_open(const char *path, int fast);
+
+#endif
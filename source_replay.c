@@ -0,0 +1,303 @@
+#include "source.h"
+#include "record.h"
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+struct replay_source {
+    struct source src;
+    int fast;                 // Ignore the recorded timing; fd then counts free buffers
+    const Uint8 *map;
+    size_t map_size;
+    const struct recording_header *header;
+    const struct recording_frame **frames;
+    int n_frames;
+    int next;                 // Next frame to deliver
+    Uint32 sequence_offset;   // Added to recorded sequences, grows every loop
+    Uint64 start;             // Replay time of the first frame in this loop, microseconds
+    Uint64 period;            // Microseconds between frames when the timestamps are unusable, else 0
+    int streaming;
+    SDL_atomic_t queued[SOURCE_MAX_BUFFERS];
+};
+
+static Uint64 now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Replay time at which frame `i` of the current loop is due
+static Uint64 due_time(const struct replay_source *r, int i) {
+    if (r->period) {
+        return r->start + (Uint64)i * r->period;
+    }
+    Uint64 first = r->frames[0]->timestamp;
+    Uint64 t = r->frames[i]->timestamp;
+    return r->start + (t > first ? t - first : 0);
+}
+
+// Frame interval the recording was made at
+static Uint64 header_period(const struct recording_header *header) {
+    Uint64 period = header->interval_denominator
+        ? (Uint64)1000000 * header->interval_numerator / header->interval_denominator : 0;
+    return period ? period : 33333;
+}
+
+// Bytes an uncompressed frame needs for the header's pitch and height, 0 for
+// compressed formats whose frames vary in size
+static size_t frame_bytes(const struct recording_header *header) {
+    const struct format_info *info = format_lookup(header->fourcc);
+    if (info && info->compressed) {
+        return 0;
+    }
+    size_t bytes = (size_t)(header->pitch > 0 ? header->pitch : 0) * header->height;
+    return header->fourcc == V4L2_PIX_FMT_NV12 ? bytes + bytes / 2 : bytes;
+}
+
+static void arm(struct replay_source *r, Uint64 when) {
+    struct itimerspec timer;
+    CLEAR(timer);
+    timer.it_value.tv_sec = when / 1000000;
+    timer.it_value.tv_nsec = when % 1000000 * 1000;
+    if (!timer.it_value.tv_sec && !timer.it_value.tv_nsec) {
+        timer.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(r->src.fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+static void replay_close(struct source *src) {
+    struct replay_source *r = (struct replay_source *)src;
+    if (src->fd >= 0) {
+        close(src->fd);
+    }
+    munmap((void *)r->map, r->map_size);
+    free(r->frames);
+    free(r);
+}
+
+// A recording plays back the mode it was made in, whatever was asked for
+static void replay_negotiate(struct source *src, const struct negotiate_request *req, struct negotiate_result *out) {
+    struct replay_source *r = (struct replay_source *)src;
+    (void)req;
+    CLEAR(*out);
+    out->fourcc = r->header->fourcc;
+    out->width = r->header->width;
+    out->height = r->header->height;
+    out->interval.numerator = r->header->interval_numerator;
+    out->interval.denominator = r->header->interval_denominator;
+}
+
+static int replay_start(struct source *src, const struct negotiate_result *mode, struct source_format *fmt) {
+    struct replay_source *r = (struct replay_source *)src;
+    (void)mode;
+    CLEAR(*fmt);
+    fmt->fourcc = r->header->fourcc;
+    fmt->width = r->header->width;
+    fmt->height = r->header->height;
+    fmt->pitch = r->header->pitch;
+    fmt->hardware_crop = r->header->hardware_crop;
+    for (int i = 0; i < src->buffers; i++) {
+        SDL_AtomicSet(&r->queued[i], 1);
+    }
+    r->next = 0;
+    r->start = now_us();
+    r->streaming = 1;
+    if (r->fast) {
+        // Readable while a buffer is free: frames are limited only by how
+        // fast the pipeline hands buffers back
+        uint64_t count = src->buffers;
+        if (write(src->fd, &count, sizeof(count)) < 0) {
+            perror("write eventfd");
+        }
+    } else {
+        arm(r, r->start);
+    }
+    return 0;
+}
+
+static void replay_stop(struct source *src) {
+    struct replay_source *r = (struct replay_source *)src;
+    uint64_t value;
+    if (r->fast) {
+        while (read(src->fd, &value, sizeof(value)) == sizeof(value)) {
+        }
+    } else {
+        struct itimerspec off;
+        CLEAR(off);
+        timerfd_settime(src->fd, 0, &off, NULL);
+    }
+    r->streaming = 0;
+}
+
+static int replay_dequeue(struct source *src, struct source_frame *frame) {
+    struct replay_source *r = (struct replay_source *)src;
+    if (!r->streaming) {
+        return -1;
+    }
+    Uint64 now = now_us();
+    uint64_t ticks;
+    if (read(src->fd, &ticks, sizeof(ticks)) != sizeof(ticks)) {
+        if (errno != EAGAIN) {
+            perror("read");
+        }
+        return -1;
+    }
+    if (!r->fast) {
+        // Skip frames whose time has passed, as a driver would drop them
+        while (r->next + 1 < r->n_frames && due_time(r, r->next + 1) <= now) {
+            r->next++;
+        }
+    }
+
+    const struct recording_frame *record = r->frames[r->next];
+    int index = -1;
+    for (int i = 0; i < src->buffers && index < 0; i++) {
+        if (SDL_AtomicCAS(&r->queued[i], 1, 0)) {
+            index = i;
+        }
+    }
+    if (index >= 0) {
+        // Frames are read straight out of the mapped file
+        frame->index = index;
+        frame->data = (const Uint8 *)(record + 1);
+        frame->bytesused = record->bytesused;
+        frame->sequence = record->sequence - r->frames[0]->sequence + r->sequence_offset;
+        frame->timestamp = r->fast ? now : due_time(r, r->next);
+    }
+
+    // Advance, looping back to the start with sequences that keep counting
+    r->next++;
+    if (r->next == r->n_frames) {
+        r->sequence_offset += r->frames[r->n_frames - 1]->sequence - r->frames[0]->sequence + 1;
+        Uint64 period = header_period(r->header);
+        if (r->n_frames > 1) {
+            period = (due_time(r, r->n_frames - 1) - r->start) / (r->n_frames - 1);
+        }
+        r->start = due_time(r, r->n_frames - 1) + period;
+        r->next = 0;
+    }
+    if (!r->fast) {
+        arm(r, due_time(r, r->next));
+    }
+    return index >= 0 ? 0 : -1;
+}
+
+static void replay_requeue(struct source *src, int index) {
+    struct replay_source *r = (struct replay_source *)src;
+    SDL_AtomicSet(&r->queued[index], 1);
+    if (r->fast && r->streaming) {
+        uint64_t one = 1;
+        if (write(src->fd, &one, sizeof(one)) < 0) {
+            perror("write eventfd");
+        }
+    }
+}
+
+static const struct source_ops replay_ops = {
+    "replay", replay_close, replay_negotiate, replay_start, replay_stop, replay_dequeue, replay_requeue,
+};
+
+struct source *source_replay_open(const char *path, int fast) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Cannot open recording");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct recording_header)) {
+        fprintf(stderr, "%s: not a circam recording\n", path);
+        close(fd);
+        return NULL;
+    }
+    const Uint8 *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    const struct recording_header *header = (const struct recording_header *)map;
+    if (memcmp(header->magic, RECORDING_MAGIC, sizeof(header->magic)) || header->width <= 0 || header->height <= 0) {
+        fprintf(stderr, "%s: not a circam recording\n", path);
+        munmap((void *)map, st.st_size);
+        return NULL;
+    }
+
+    struct replay_source *r = calloc(1, sizeof(*r));
+    if (!r) {
+        perror("calloc");
+        munmap((void *)map, st.st_size);
+        return NULL;
+    }
+    r->map = map;
+    r->map_size = st.st_size;
+    r->header = header;
+    r->fast = fast;
+    r->src.ops = &replay_ops;
+    r->src.fd = -1;
+
+    // Index the frames. A frame cut short by an interrupted recording ends it,
+    // and so does an uncompressed frame too small for the header's format,
+    // which the upload would read past.
+    size_t min_bytes = frame_bytes(header);
+    size_t offset = sizeof(*header);
+    int capacity = 0;
+    while (offset + sizeof(struct recording_frame) <= r->map_size) {
+        const struct recording_frame *record = (const struct recording_frame *)(map + offset);
+        size_t size = sizeof(*record) + (record->bytesused + RECORDING_ALIGN - 1) / RECORDING_ALIGN * RECORDING_ALIGN;
+        if (record->bytesused > r->map_size - offset - sizeof(*record)) {
+            break;
+        }
+        if (record->bytesused < min_bytes) {
+            fprintf(stderr, "%s: frame %d holds %u bytes, %zu needed, ending the recording there\n", path, r->n_frames,
+                    record->bytesused, min_bytes);
+            break;
+        }
+        if (r->n_frames == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            const struct recording_frame **frames = realloc(r->frames, capacity * sizeof(*frames));
+            if (!frames) {
+                perror("realloc");
+                replay_close(&r->src);
+                return NULL;
+            }
+            r->frames = frames;
+        }
+        r->frames[r->n_frames++] = record;
+        offset += size;
+    }
+    if (r->n_frames == 0) {
+        fprintf(stderr, "%s: recording has no frames\n", path);
+        replay_close(&r->src);
+        return NULL;
+    }
+
+    // Timestamps that never advance, or go backwards, would make every frame
+    // due at once; pace those recordings at the header interval instead
+    int increasing = r->frames[r->n_frames - 1]->timestamp > r->frames[0]->timestamp;
+    for (int i = 1; i < r->n_frames && increasing; i++) {
+        increasing = r->frames[i]->timestamp >= r->frames[i - 1]->timestamp;
+    }
+    if (!increasing && r->n_frames > 1) {
+        r->period = header_period(header);
+        fprintf(stderr, "%s: timestamps do not increase, replaying at the recorded frame interval\n", path);
+    }
+
+    r->src.fd = fast ? eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE) : timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (r->src.fd < 0) {
+        perror(fast ? "eventfd" : "timerfd_create");
+        replay_close(&r->src);
+        return NULL;
+    }
+    fprintf(stderr, "Replaying %d frames from %s%s\n", r->n_frames, path, fast ? " as fast as possible" : "");
+    return &r->src;
+}
@@ -0,0 +1,415 @@
+#include "source.h"
+#include "stamp.h"
+#include <linux/videodev2.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jpeglib.h>
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+#define MJPEG_LOOP 8     // Distinct pre-encoded MJPEG frames, shown in turn
+#define MJPEG_QUALITY 80
+#define COUNTER_BITS 32
+#define COUNTER_TAG "circam" // COM marker payload prefix, followed by the big-endian sequence
+
+// 75% color bars (BT.601 limited range Y, U, V)
+static const Uint8 bars[8][3] = {
+    { 180, 128, 128 }, { 162, 44, 142 }, { 131, 156, 44 }, { 112, 72, 58 },
+    { 84, 184, 198 }, { 65, 100, 212 }, { 35, 212, 114 }, { 16, 128, 128 },
+};
+
+struct synthetic_source {
+    struct source src;
+    Uint32 fourcc;      // Frame layout; MJPEG frames are drawn as YUYV first
+    int width, height;
+    int pitch;
+    size_t frame_size;
+    Uint8 *pattern;     // Static background, in the drawn layout
+    Uint8 *jpeg[MJPEG_LOOP];
+    size_t jpeg_size[MJPEG_LOOP];
+    size_t counter_offset[MJPEG_LOOP]; // Where the sequence goes in the COM marker
+    Uint8 *buffers[SOURCE_MAX_BUFFERS];
+    SDL_atomic_t queued[SOURCE_MAX_BUFFERS];
+    Uint32 sequence;
+    int streaming;
+    int stamp;          // Draw the time into every frame (SOURCE_STAMP_TIME)
+    Uint8 *scratch;     // Stamped MJPEG frames are drawn here before encoding
+};
+
+static Uint64 now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Fill a rectangle with one color. x, y, w and h must be even.
+static void fill_rect(const struct synthetic_source *s, Uint32 layout, Uint8 *frame, int x, int y, int w, int h,
+                      const Uint8 yuv[3]) {
+    if (layout == V4L2_PIX_FMT_NV12) {
+        for (int row = y; row < y + h; row++) {
+            memset(frame + (size_t)row * s->pitch + x, yuv[0], w);
+        }
+        Uint8 *uv = frame + (size_t)s->height * s->pitch;
+        for (int row = y / 2; row < (y + h) / 2; row++) {
+            Uint8 *p = uv + (size_t)row * s->pitch + x;
+            for (int i = 0; i < w; i += 2) {
+                p[i] = yuv[1];
+                p[i + 1] = yuv[2];
+            }
+        }
+        return;
+    }
+    Uint8 pair[4];
+    if (layout == V4L2_PIX_FMT_UYVY) {
+        pair[0] = yuv[1], pair[1] = yuv[0], pair[2] = yuv[2], pair[3] = yuv[0];
+    } else {
+        pair[0] = yuv[0], pair[1] = yuv[1], pair[2] = yuv[0], pair[3] = yuv[2];
+    }
+    for (int row = y; row < y + h; row++) {
+        Uint8 *p = frame + (size_t)row * s->pitch + (size_t)x * 2;
+        for (int i = 0; i < w; i += 2, p += 4) {
+            memcpy(p, pair, 4);
+        }
+    }
+}
+
+// Color bars over a gray ramp
+static void draw_pattern(const struct synthetic_source *s, Uint32 layout, Uint8 *frame) {
+    int bar_height = (s->height * 2 / 3) & ~1;
+    int bar_width = (s->width / 8) & ~1;
+    for (int i = 0; i < 8; i++) {
+        int x = i * bar_width;
+        fill_rect(s, layout, frame, x, 0, i == 7 ? s->width - x : bar_width, bar_height, bars[i]);
+    }
+    int step_width = (s->width / 16) & ~1;
+    for (int i = 0; i < 16; i++) {
+        int x = i * step_width;
+        Uint8 gray[3] = { (Uint8)(16 + i * 219 / 15), 128, 128 };
+        fill_rect(s, layout, frame, x, bar_height, i == 15 ? s->width - x : step_width, s->height - bar_height, gray);
+    }
+}
+
+// Overlay the frame counter as a row of black and white blocks, and a block
+// that moves a little every frame, inside the centered square
+static void draw_counter(const struct synthetic_source *s, Uint32 layout, Uint8 *frame, Uint32 counter) {
+    static const Uint8 white[3] = { 235, 128, 128 }, black[3] = { 16, 128, 128 }, marker[3] = { 81, 90, 240 };
+    int square = s->width < s->height ? s->width : s->height;
+    int x0 = ((s->width - square) / 2) & ~1;
+    int y0 = ((s->height - square) / 2) & ~1;
+    int block = (square / (COUNTER_BITS + 8)) & ~1;
+    if (block < 2) {
+        return;
+    }
+    for (int i = 0; i < COUNTER_BITS; i++) {
+        int bit = (counter >> (COUNTER_BITS - 1 - i)) & 1;
+        fill_rect(s, layout, frame, x0 + (i + 4) * block, y0 + 4 * block, block, block, bit ? white : black);
+    }
+    int size = (square / 8) & ~1;
+    int x = x0 + ((int)(counter * 8 % (Uint32)(square - size)) & ~1);
+    fill_rect(s, layout, frame, x, y0 + (((square - size) / 2) & ~1), size, size, marker);
+}
+
+// Draw the time stamp row into the centered square
+static void draw_stamp(const struct synthetic_source *s, Uint32 layout, Uint8 *frame, Uint32 value) {
+    static const Uint8 white[3] = { 235, 128, 128 }, black[3] = { 16, 128, 128 };
+    int square = s->width < s->height ? s->width : s->height;
+    int x0 = ((s->width - square) / 2) & ~1;
+    int y0 = ((s->height - square) / 2) & ~1;
+    int block = stamp_block(square);
+    if (!block) {
+        return;
+    }
+    for (int column = STAMP_COLUMN - 1; column <= STAMP_COLUMN + STAMP_BITS; column++) {
+        fill_rect(s, layout, frame, x0 + column * block, y0 + STAMP_ROW * block, block, block,
+                  stamp_bit(value, column) ? white : black);
+    }
+}
+
+// Encode one YUYV frame as 4:2:2 baseline JPEG with a COM marker holding
+// the sequence number. Returns NULL on failure.
+static Uint8 *encode_jpeg(const struct synthetic_source *s, const Uint8 *yuyv, size_t *size, size_t *counter_offset) {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    unsigned char *out = NULL;
+    unsigned long out_size = 0;
+    jpeg_mem_dest(&cinfo, &out, &out_size);
+    cinfo.image_width = s->width;
+    cinfo.image_height = s->height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, MJPEG_QUALITY, TRUE);
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 1;
+    jpeg_start_compress(&cinfo, TRUE);
+    Uint8 comment[sizeof(COUNTER_TAG) - 1 + 4] = COUNTER_TAG;
+    jpeg_write_marker(&cinfo, JPEG_COM, comment, sizeof(comment));
+
+    Uint8 *row = malloc((size_t)s->width * 3);
+    if (!row) {
+        jpeg_destroy_compress(&cinfo);
+        free(out);
+        return NULL;
+    }
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const Uint8 *p = yuyv + (size_t)cinfo.next_scanline * s->pitch;
+        for (int x = 0; x < s->width; x += 2, p += 4) {
+            Uint8 *q = row + x * 3;
+            q[0] = p[0], q[1] = p[1], q[2] = p[3];
+            q[3] = p[2], q[4] = p[1], q[5] = p[3];
+        }
+        JSAMPROW rows[1] = { row };
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+
+    // Find the COM payload so each frame can carry its own sequence
+    *counter_offset = 0;
+    for (size_t i = 2; i + 4 + sizeof(comment) <= out_size; i++) {
+        if (out[i] == 0xFF && out[i + 1] == JPEG_COM && !memcmp(out + i + 4, COUNTER_TAG, sizeof(COUNTER_TAG) - 1)) {
+            *counter_offset = i + 4 + sizeof(COUNTER_TAG) - 1;
+            break;
+        }
+    }
+    *size = out_size;
+    return out;
+}
+
+static void synthetic_stop(struct source *src) {
+    struct synthetic_source *s = (struct synthetic_source *)src;
+    struct itimerspec off;
+    CLEAR(off);
+    timerfd_settime(src->fd, 0, &off, NULL);
+    s->streaming = 0;
+    for (int i = 0; i < SOURCE_MAX_BUFFERS; i++) {
+        free(s->buffers[i]);
+        s->buffers[i] = NULL;
+    }
+    for (int i = 0; i < MJPEG_LOOP; i++) {
+        free(s->jpeg[i]);
+        s->jpeg[i] = NULL;
+    }
+    free(s->pattern);
+    s->pattern = NULL;
+    free(s->scratch);
+    s->scratch = NULL;
+}
+
+static void synthetic_close(struct source *src) {
+    synthetic_stop(src);
+    close(src->fd);
+    free(src);
+}
+
+// Any size and rate: the overrides, or a 16:9 frame whose height covers the
+// target size
+static void synthetic_negotiate(struct source *src, const struct negotiate_request *req, struct negotiate_result *out) {
+    (void)src;
+    CLEAR(*out);
+    out->fourcc = req->fourcc ? req->fourcc : V4L2_PIX_FMT_YUYV;
+    if (out->fourcc == V4L2_PIX_FMT_JPEG) {
+        out->fourcc = V4L2_PIX_FMT_MJPEG;
+    }
+    if (req->width) {
+        out->width = req->width;
+        out->height = req->height;
+    } else {
+        out->height = req->target_size;
+        out->width = req->target_size * 16 / 9;
+    }
+    out->width = (out->width + 1) & ~1;
+    out->height = (out->height + 1) & ~1;
+    out->interval = (struct v4l2_fract){ 1, req->fps ? req->fps : DEFAULT_FPS };
+}
+
+static int synthetic_start(struct source *src, const struct negotiate_result *mode, struct source_format *fmt) {
+    struct synthetic_source *s = (struct synthetic_source *)src;
+    s->fourcc = mode->fourcc;
+    if (s->fourcc != V4L2_PIX_FMT_YUYV && s->fourcc != V4L2_PIX_FMT_UYVY && s->fourcc != V4L2_PIX_FMT_NV12 &&
+        s->fourcc != V4L2_PIX_FMT_MJPEG) {
+        fprintf(stderr, "Synthetic source cannot produce this pixel format\n");
+        return -1;
+    }
+    s->width = mode->width;
+    s->height = mode->height;
+    Uint32 layout = s->fourcc == V4L2_PIX_FMT_MJPEG ? V4L2_PIX_FMT_YUYV : s->fourcc;
+    s->pitch = layout == V4L2_PIX_FMT_NV12 ? s->width : s->width * 2;
+    s->frame_size = layout == V4L2_PIX_FMT_NV12 ? (size_t)s->pitch * s->height * 3 / 2 : (size_t)s->pitch * s->height;
+    s->pattern = malloc(s->frame_size);
+    if (!s->pattern) {
+        perror("malloc");
+        return -1;
+    }
+    draw_pattern(s, layout, s->pattern);
+
+    // MJPEG frames are encoded once up front; only the COM counter changes
+    size_t buffer_size = s->frame_size;
+    if (s->fourcc == V4L2_PIX_FMT_MJPEG) {
+        Uint8 *frame = malloc(s->frame_size);
+        if (!frame) {
+            perror("malloc");
+            synthetic_stop(src);
+            return -1;
+        }
+        buffer_size = 0;
+        for (int i = 0; i < MJPEG_LOOP; i++) {
+            memcpy(frame, s->pattern, s->frame_size);
+            draw_counter(s, layout, frame, i);
+            s->jpeg[i] = encode_jpeg(s, frame, &s->jpeg_size[i], &s->counter_offset[i]);
+            if (!s->jpeg[i]) {
+                fprintf(stderr, "Synthetic source: JPEG encoding failed\n");
+                free(frame);
+                synthetic_stop(src);
+                return -1;
+            }
+            if (s->jpeg_size[i] > buffer_size) {
+                buffer_size = s->jpeg_size[i];
+            }
+        }
+        free(frame);
+
+        // Stamped frames are encoded as they are made; their size varies a
+        // little with the stamp, the raw frame size bounds it
+        if (s->stamp) {
+            s->scratch = malloc(s->frame_size);
+            if (!s->scratch) {
+                perror("malloc");
+                synthetic_stop(src);
+                return -1;
+            }
+            buffer_size = s->frame_size > buffer_size ? s->frame_size : buffer_size;
+        }
+    }
+
+    for (int i = 0; i < src->buffers; i++) {
+        s->buffers[i] = malloc(buffer_size);
+        if (!s->buffers[i]) {
+            perror("malloc");
+            synthetic_stop(src);
+            return -1;
+        }
+        SDL_AtomicSet(&s->queued[i], 1);
+    }
+
+    // Frames are due on every tick of the timer
+    struct itimerspec timer;
+    CLEAR(timer);
+    long long period = 1000000000LL * mode->interval.numerator / mode->interval.denominator;
+    timer.it_interval.tv_sec = period / 1000000000;
+    timer.it_interval.tv_nsec = period % 1000000000;
+    timer.it_value = timer.it_interval;
+    if (timerfd_settime(src->fd, 0, &timer, NULL) < 0) {
+        perror("timerfd_settime");
+        synthetic_stop(src);
+        return -1;
+    }
+    s->streaming = 1;
+
+    CLEAR(*fmt);
+    fmt->fourcc = s->fourcc;
+    fmt->width = s->width;
+    fmt->height = s->height;
+    fmt->pitch = s->fourcc == V4L2_PIX_FMT_MJPEG ? 0 : s->pitch;
+    return 0;
+}
+
+static int synthetic_dequeue(struct source *src, struct source_frame *frame) {
+    struct synthetic_source *s = (struct synthetic_source *)src;
+    uint64_t ticks;
+    if (read(src->fd, &ticks, sizeof(ticks)) != sizeof(ticks)) {
+        if (errno != EAGAIN) {
+            perror("read timerfd");
+        }
+        return -1;
+    }
+    // Missed ticks and ticks without a free buffer are dropped frames,
+    // exactly like a driver running out of buffers
+    Uint32 sequence = s->sequence + (Uint32)ticks - 1;
+    s->sequence += (Uint32)ticks;
+    int index = -1;
+    for (int i = 0; i < src->buffers && index < 0; i++) {
+        if (SDL_AtomicCAS(&s->queued[i], 1, 0)) {
+            index = i;
+        }
+    }
+    if (index < 0) {
+        return -1;
+    }
+
+    Uint8 *data = s->buffers[index];
+    if (s->stamp && s->fourcc == V4L2_PIX_FMT_MJPEG) {
+        // The stamp changes every frame, so stamped MJPEG is encoded here
+        memcpy(s->scratch, s->pattern, s->frame_size);
+        draw_counter(s, V4L2_PIX_FMT_YUYV, s->scratch, sequence);
+        draw_stamp(s, V4L2_PIX_FMT_YUYV, s->scratch, (Uint32)now_us());
+        size_t size, counter_offset;
+        Uint8 *jpeg = encode_jpeg(s, s->scratch, &size, &counter_offset);
+        if (!jpeg || size > s->frame_size) {
+            free(jpeg);
+            SDL_AtomicSet(&s->queued[index], 1);
+            return -1;
+        }
+        memcpy(data, jpeg, size);
+        free(jpeg);
+        if (counter_offset) {
+            Uint8 *p = data + counter_offset;
+            p[0] = sequence >> 24, p[1] = sequence >> 16, p[2] = sequence >> 8, p[3] = sequence;
+        }
+        frame->bytesused = size;
+    } else if (s->fourcc == V4L2_PIX_FMT_MJPEG) {
+        int loop = sequence % MJPEG_LOOP;
+        memcpy(data, s->jpeg[loop], s->jpeg_size[loop]);
+        if (s->counter_offset[loop]) {
+            Uint8 *p = data + s->counter_offset[loop];
+            p[0] = sequence >> 24, p[1] = sequence >> 16, p[2] = sequence >> 8, p[3] = sequence;
+        }
+        frame->bytesused = s->jpeg_size[loop];
+    } else {
+        memcpy(data, s->pattern, s->frame_size);
+        draw_counter(s, s->fourcc, data, sequence);
+        if (s->stamp) {
+            draw_stamp(s, s->fourcc, data, (Uint32)now_us());
+        }
+        frame->bytesused = s->frame_size;
+    }
+    frame->index = index;
+    frame->data = data;
+    frame->sequence = sequence;
+    frame->timestamp = now_us();
+    return 0;
+}
+
+static void synthetic_requeue(struct source *src, int index) {
+    struct synthetic_source *s = (struct synthetic_source *)src;
+    SDL_AtomicSet(&s->queued[index], 1);
+}
+
+static const struct source_ops synthetic_ops = {
+    "synthetic", synthetic_close, synthetic_negotiate, synthetic_start, synthetic_stop, synthetic_dequeue,
+    synthetic_requeue,
+};
+
+struct source *source_synthetic_open(int stamp) {
+    struct synthetic_source *s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+    s->src.ops = &synthetic_ops;
+    s->stamp = stamp;
+    s->src.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (s->src.fd < 0) {
+        perror("timerfd_create");
+        free(s);
+        return NULL;
+    }
+    return &s->src;
+}
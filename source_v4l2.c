@@ -0,0 +1,218 @@
+#include "source.h"
+#include <linux/videodev2.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+// Structure to hold buffer information
+struct buffer {
+    void *start;
+    size_t length;
+};
+
+struct v4l2_source {
+    struct source src;
+    struct buffer *buffers;
+    unsigned int n_buffers;
+};
+
+static void v4l2_close(struct source *src) {
+    close(src->fd);
+    free(src);
+}
+
+static void v4l2_negotiate(struct source *src, const struct negotiate_request *req, struct negotiate_result *out) {
+    negotiate_format(src->fd, req, out);
+}
+
+static void v4l2_stop(struct source *src) {
+    struct v4l2_source *v = (struct v4l2_source *)src;
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ioctl(src->fd, VIDIOC_STREAMOFF, &type);
+    for (unsigned int i = 0; i < v->n_buffers; i++) {
+        if (v->buffers[i].start != MAP_FAILED) {
+            munmap(v->buffers[i].start, v->buffers[i].length);
+        }
+    }
+    free(v->buffers);
+    v->buffers = NULL;
+    v->n_buffers = 0;
+
+    // Free the driver's buffers so the next S_FMT may change the size
+    struct v4l2_requestbuffers req;
+    CLEAR(req);
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    ioctl(src->fd, VIDIOC_REQBUFS, &req);
+}
+
+static void v4l2_requeue(struct source *src, int index) {
+    struct v4l2_buffer buf;
+    CLEAR(buf);
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (ioctl(src->fd, VIDIOC_QBUF, &buf) < 0) {
+        perror("VIDIOC_QBUF");
+    }
+}
+
+static int v4l2_start(struct source *src, const struct negotiate_result *mode, struct source_format *out) {
+    struct v4l2_source *v = (struct v4l2_source *)src;
+    struct v4l2_format fmt;
+    if (apply_format(src->fd, mode, &fmt) < 0) {
+        return -1;
+    }
+    CLEAR(*out);
+    out->hardware_crop = request_square_crop(src->fd, mode, &fmt);
+    out->fourcc = fmt.fmt.pix.pixelformat;
+    out->width = fmt.fmt.pix.width;
+    out->height = fmt.fmt.pix.height;
+    out->pitch = fmt.fmt.pix.bytesperline;
+    if (!out->pitch) {
+        out->pitch = out->fourcc == V4L2_PIX_FMT_NV12 ? out->width : out->width * 2;
+    }
+
+    // Request buffers. The driver may grant fewer than asked; raw frames are
+    // shown from these buffers and cannot run with less than the minimum.
+    const struct format_info *info = format_lookup(out->fourcc);
+    unsigned int min_count = info && !info->compressed ? SOURCE_RAW_MIN_BUFFERS : 1;
+    struct v4l2_requestbuffers req;
+    CLEAR(req);
+    req.count = (unsigned int)src->buffers > min_count ? (unsigned int)src->buffers : min_count;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(src->fd, VIDIOC_REQBUFS, &req) < 0) {
+        perror("VIDIOC_REQBUFS");
+        return -1;
+    }
+    if (req.count < min_count) {
+        fprintf(stderr, "VIDIOC_REQBUFS granted %u buffers, %u needed\n", req.count, min_count);
+        v4l2_stop(src);
+        return -1;
+    }
+
+    // Map buffers
+    v->buffers = calloc(req.count, sizeof(*v->buffers));
+    if (!v->buffers) {
+        perror("calloc");
+        v4l2_stop(src);
+        return -1;
+    }
+    for (unsigned int i = 0; i < req.count; i++) {
+        v->buffers[i].start = MAP_FAILED;
+    }
+    v->n_buffers = req.count;
+    for (unsigned int i = 0; i < req.count; i++) {
+        struct v4l2_buffer buf;
+        CLEAR(buf);
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (ioctl(src->fd, VIDIOC_QUERYBUF, &buf) < 0) {
+            perror("VIDIOC_QUERYBUF");
+            v4l2_stop(src);
+            return -1;
+        }
+        v->buffers[i].length = buf.length;
+        v->buffers[i].start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, src->fd, buf.m.offset);
+        if (v->buffers[i].start == MAP_FAILED) {
+            perror("mmap");
+            v4l2_stop(src);
+            return -1;
+        }
+    }
+
+    // Queue buffers
+    for (unsigned int i = 0; i < req.count; i++) {
+        struct v4l2_buffer buf;
+        CLEAR(buf);
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (ioctl(src->fd, VIDIOC_QBUF, &buf) < 0) {
+            perror("VIDIOC_QBUF");
+            v4l2_stop(src);
+            return -1;
+        }
+    }
+
+    // Start streaming
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (ioctl(src->fd, VIDIOC_STREAMON, &type) < 0) {
+        perror("VIDIOC_STREAMON");
+        v4l2_stop(src);
+        return -1;
+    }
+    return 0;
+}
+
+static int v4l2_dequeue(struct source *src, struct source_frame *frame) {
+    struct v4l2_source *v = (struct v4l2_source *)src;
+    struct v4l2_buffer buf;
+    CLEAR(buf);
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(src->fd, VIDIOC_DQBUF, &buf) < 0) {
+        if (errno != EAGAIN) {
+            perror("VIDIOC_DQBUF");
+        }
+        return -1;
+    }
+    frame->index = buf.index;
+    frame->data = v->buffers[buf.index].start;
+    frame->bytesused = buf.bytesused;
+    frame->sequence = buf.sequence;
+
+    // Timestamps on the monotonic clock can be compared with present time
+    frame->timestamp = 0;
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        frame->timestamp = (Uint64)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+    }
+    return 0;
+}
+
+static const struct source_ops v4l2_ops = {
+    "v4l2", v4l2_close, v4l2_negotiate, v4l2_start, v4l2_stop, v4l2_dequeue, v4l2_requeue,
+};
+
+struct source *source_v4l2_open(const char *device) {
+    // Open V4L2 device. Non-blocking, so the capture thread can drain every
+    // ready buffer and stop when there are no more.
+    int fd = open(device, O_RDWR | O_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("Cannot open device");
+        return NULL;
+    }
+
+    // Query device capabilities
+    struct v4l2_capability cap;
+    CLEAR(cap);
+    if (ioctl(fd, VIDIOC_QUERYCAP, &cap) < 0) {
+        perror("VIDIOC_QUERYCAP");
+        close(fd);
+        return NULL;
+    }
+    if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
+        fprintf(stderr, "Device does not support video capture\n");
+        close(fd);
+        return NULL;
+    }
+
+    struct v4l2_source *v = calloc(1, sizeof(*v));
+    if (!v) {
+        perror("calloc");
+        close(fd);
+        return NULL;
+    }
+    v->src.ops = &v4l2_ops;
+    v->src.fd = fd;
+    return &v->src;
+}
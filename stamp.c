@@ -0,0 +1,51 @@
+#include "stamp.h"
+
+int stamp_block(int size) {
+    int block = (size / STAMP_DIVISIONS) & ~1;
+    return block >= 2 ? block : 0;
+}
+
+int stamp_bit(Uint32 value, int column) {
+    int bit = column - STAMP_COLUMN;
+    if (bit < 0) {
+        return 1;
+    }
+    if (bit >= STAMP_BITS) {
+        return 0;
+    }
+    return (value >> (STAMP_BITS - 1 - bit)) & 1;
+}
+
+// Sample the middle of each block, scaled to the window
+static int read_column(const Uint32 *row, int width, int size, int block, int column) {
+    int x = (int)(((Sint64)column * block + block / 2) * width / size);
+    if (x < 0 || x >= width) {
+        return -1;
+    }
+    Uint32 p = row[x];
+    int level = ((p >> 16) & 0xFF) + ((p >> 8) & 0xFF) + (p & 0xFF);
+    return level > 3 * 128;
+}
+
+int stamp_read(const Uint32 *row, int width, int size, Uint32 *value) {
+    int block = stamp_block(size);
+    if (!block || read_column(row, width, size, block, STAMP_COLUMN - 1) != 1 ||
+        read_column(row, width, size, block, STAMP_COLUMN + STAMP_BITS) != 0) {
+        return -1;
+    }
+    Uint32 v = 0;
+    for (int i = 0; i < STAMP_BITS; i++) {
+        v = v << 1 | (Uint32)read_column(row, width, size, block, STAMP_COLUMN + i);
+    }
+    *value = v;
+    return 0;
+}
+
+int stamp_row_y(int width, int size) {
+    int block = stamp_block(size);
+    return (int)(((Sint64)STAMP_ROW * block + block / 2) * width / (size ? size : 1));
+}
+
+Uint64 stamp_time(Uint32 value, Uint64 now) {
+    return now - (Uint32)((Uint32)now - value);
+}
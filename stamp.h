@@ -0,0 +1,33 @@
+#ifndef STAMP_H
+#define STAMP_H
+
+#include <SDL2/SDL.h>
+
+// --g2g time stamps: the synthetic source draws the time it made each frame
+// as a row of black and white blocks in the centered square, inside the
+// circle, and circam reads it back from what it renders.
+
+#define STAMP_BITS 32      // Low bits of the CLOCK_MONOTONIC microsecond time
+#define STAMP_DIVISIONS 40 // The square is this many blocks wide
+#define STAMP_COLUMN 4     // Block column of the most significant bit
+#define STAMP_ROW 28       // Block row; below the marker, away from the circle's edge
+
+// Side of one block in a square of `size` pixels, 0 when too small to draw
+int stamp_block(int size);
+
+// Block column `column` is white, counting STAMP_COLUMN - 1 (a white guard)
+// to STAMP_COLUMN + STAMP_BITS (a black guard)
+int stamp_bit(Uint32 value, int column);
+
+// Decode a stamp from a row of ARGB8888 pixels through the middle of the
+// stamp row, where the square of `size` frame pixels is drawn `width` pixels
+// wide. Returns -1 when the guards do not match.
+int stamp_read(const Uint32 *row, int width, int size, Uint32 *value);
+
+// Window row to pass to stamp_read()
+int stamp_row_y(int width, int size);
+
+// The full time `value` stands for, at or before `now`
+Uint64 stamp_time(Uint32 value, Uint64 now);
+
+#endif
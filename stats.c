@@ -0,0 +1,293 @@
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+static const char *stage_names[STAGE_COUNT] = { "dqbuf", "upload", "render", "present" };
+
+// Counters for one report interval
+struct interval {
+    Uint32 captured;
+    Uint32 presented;
+    Uint32 dropped;  // Sequence gaps at the driver
+    Uint32 discarded; // Stale buffers requeued by the capture thread
+    Uint64 wall[STAGE_COUNT];
+    Uint64 cpu[STAGE_COUNT];
+    Uint32 count[STAGE_COUNT];
+    Uint32 latency[STATS_MAX_SAMPLES]; // Capture to present, microseconds
+    int n_latency;
+    Uint32 glass[STATS_MAX_SAMPLES];   // Stamp to present (--g2g)
+    Uint32 source[STATS_MAX_SAMPLES];  // Stamp to capture timestamp
+    int n_glass;
+    Uint32 unreadable;                 // Presented frames without a readable stamp
+};
+
+// Totals since stats were enabled
+struct run {
+    Uint64 captured;
+    Uint64 presented;
+    Uint64 dropped;
+    Uint64 discarded;
+    Uint64 wall[STAGE_COUNT];
+    Uint64 cpu[STAGE_COUNT];
+    Uint64 count[STAGE_COUNT];
+    Uint32 latency[STATS_RUN_SAMPLES];
+    int n_latency;
+    Uint32 glass[STATS_RUN_SAMPLES];
+    Uint32 source[STATS_RUN_SAMPLES];
+    int n_glass;
+    Uint64 unreadable;
+};
+
+struct stats {
+    SDL_mutex *lock;  // Capture and main thread both update `cur` and `run`
+    SDL_atomic_t enabled;
+    struct interval cur;
+    struct run run;
+    Uint64 start;     // Start of the interval, microseconds
+    Uint64 run_start;
+    int have_captured;
+    Uint32 last_captured;
+};
+
+static Uint64 clock_us(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (Uint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+Uint64 stats_now_us(void) {
+    return clock_us(CLOCK_MONOTONIC);
+}
+
+struct stats *stats_create(int enabled) {
+    struct stats *st = calloc(1, sizeof(*st));
+    if (!st) {
+        return NULL;
+    }
+    st->lock = SDL_CreateMutex();
+    if (!st->lock) {
+        free(st);
+        return NULL;
+    }
+    stats_set_enabled(st, enabled);
+    return st;
+}
+
+void stats_destroy(struct stats *st) {
+    if (!st) {
+        return;
+    }
+    SDL_DestroyMutex(st->lock);
+    free(st);
+}
+
+void stats_set_enabled(struct stats *st, int enabled) {
+    SDL_LockMutex(st->lock);
+    CLEAR(st->cur);
+    CLEAR(st->run);
+    st->start = st->run_start = stats_now_us();
+    st->have_captured = 0;
+    SDL_AtomicSet(&st->enabled, enabled);
+    SDL_UnlockMutex(st->lock);
+}
+
+int stats_enabled(struct stats *st) {
+    return SDL_AtomicGet(&st->enabled);
+}
+
+void stats_begin(struct stats *st, struct stats_timer *t) {
+    if (!SDL_AtomicGet(&st->enabled)) {
+        t->wall = 0;
+        return;
+    }
+    t->wall = clock_us(CLOCK_MONOTONIC);
+    t->cpu = clock_us(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void stats_end(struct stats *st, enum stats_stage stage, const struct stats_timer *t) {
+    if (!SDL_AtomicGet(&st->enabled)) {
+        return;
+    }
+    Uint64 wall = clock_us(CLOCK_MONOTONIC);
+    Uint64 cpu = clock_us(CLOCK_THREAD_CPUTIME_ID);
+    SDL_LockMutex(st->lock);
+    // A timer started before stats were enabled, or before they were last
+    // toggled, is dropped. One spanning a report goes in the new interval.
+    if (t->wall && t->wall >= st->run_start) {
+        st->cur.wall[stage] += wall - t->wall;
+        st->cur.cpu[stage] += cpu - t->cpu;
+        st->cur.count[stage]++;
+        st->run.wall[stage] += wall - t->wall;
+        st->run.cpu[stage] += cpu - t->cpu;
+        st->run.count[stage]++;
+    }
+    SDL_UnlockMutex(st->lock);
+}
+
+void stats_captured(struct stats *st, Uint32 sequence) {
+    if (!SDL_AtomicGet(&st->enabled)) {
+        return;
+    }
+    SDL_LockMutex(st->lock);
+    st->cur.captured++;
+    st->run.captured++;
+    if (st->have_captured && sequence - st->last_captured > 1 && sequence - st->last_captured < 0x80000000u) {
+        st->cur.dropped += sequence - st->last_captured - 1;
+        st->run.dropped += sequence - st->last_captured - 1;
+    }
+    st->have_captured = 1;
+    st->last_captured = sequence;
+    SDL_UnlockMutex(st->lock);
+}
+
+void stats_discarded(struct stats *st, Uint32 count) {
+    if (!count || !SDL_AtomicGet(&st->enabled)) {
+        return;
+    }
+    SDL_LockMutex(st->lock);
+    st->cur.discarded += count;
+    st->run.discarded += count;
+    SDL_UnlockMutex(st->lock);
+}
+
+void stats_presented(struct stats *st, Uint64 timestamp) {
+    if (!SDL_AtomicGet(&st->enabled)) {
+        return;
+    }
+    Uint64 now = stats_now_us();
+    SDL_LockMutex(st->lock);
+    st->cur.presented++;
+    st->run.presented++;
+    if (timestamp && timestamp <= now) {
+        if (st->cur.n_latency < STATS_MAX_SAMPLES) {
+            st->cur.latency[st->cur.n_latency++] = (Uint32)(now - timestamp);
+        }
+        if (st->run.n_latency < STATS_RUN_SAMPLES) {
+            st->run.latency[st->run.n_latency++] = (Uint32)(now - timestamp);
+        }
+    }
+    SDL_UnlockMutex(st->lock);
+}
+
+void stats_stamped(struct stats *st, Uint64 stamp, Uint64 timestamp) {
+    if (!SDL_AtomicGet(&st->enabled)) {
+        return;
+    }
+    Uint64 now = stats_now_us();
+    SDL_LockMutex(st->lock);
+    if (!stamp || stamp > now || (timestamp && timestamp < stamp)) {
+        st->cur.unreadable++;
+        st->run.unreadable++;
+    } else {
+        Uint32 source = timestamp ? (Uint32)(timestamp - stamp) : 0;
+        if (st->cur.n_glass < STATS_MAX_SAMPLES) {
+            st->cur.glass[st->cur.n_glass] = (Uint32)(now - stamp);
+            st->cur.source[st->cur.n_glass++] = source;
+        }
+        if (st->run.n_glass < STATS_RUN_SAMPLES) {
+            st->run.glass[st->run.n_glass] = (Uint32)(now - stamp);
+            st->run.source[st->run.n_glass++] = source;
+        }
+    }
+    SDL_UnlockMutex(st->lock);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    Uint32 x = *(const Uint32 *)a, y = *(const Uint32 *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(const Uint32 *sorted, int n, int p) {
+    return sorted[(n - 1) * p / 100] / 1000.0;
+}
+
+int stats_report(struct stats *st) {
+    if (!SDL_AtomicGet(&st->enabled)) {
+        return -1;
+    }
+    Uint64 now = stats_now_us();
+    SDL_LockMutex(st->lock);
+    Uint64 elapsed = now - st->start;
+    if (elapsed < STATS_REPORT_MS * 1000) {
+        SDL_UnlockMutex(st->lock);
+        return (int)((STATS_REPORT_MS * 1000 - elapsed + 999) / 1000);
+    }
+    struct interval iv = st->cur;
+    CLEAR(st->cur);
+    st->start = now;
+    SDL_UnlockMutex(st->lock);
+
+    // Frames captured but replaced by a newer one between the capture thread
+    // and the screen
+    Uint32 skipped = iv.captured > iv.presented + iv.discarded ? iv.captured - iv.presented - iv.discarded : 0;
+    double seconds = elapsed / 1e6;
+    fprintf(stderr, "stats: capture %.1f fps, present %.1f fps, dropped %u, discarded %u, skipped %u",
+            iv.captured / seconds, iv.presented / seconds, iv.dropped, iv.discarded, skipped);
+    if (iv.n_latency) {
+        qsort(iv.latency, iv.n_latency, sizeof(iv.latency[0]), compare_u32);
+        fprintf(stderr, ", latency p50 %.1f p90 %.1f p99 %.1f max %.1f ms", percentile_ms(iv.latency, iv.n_latency, 50),
+                percentile_ms(iv.latency, iv.n_latency, 90), percentile_ms(iv.latency, iv.n_latency, 99),
+                iv.latency[iv.n_latency - 1] / 1000.0);
+    }
+    if (iv.n_glass || iv.unreadable) {
+        fprintf(stderr, "\n       glass-to-glass");
+        if (iv.n_glass) {
+            qsort(iv.glass, iv.n_glass, sizeof(iv.glass[0]), compare_u32);
+            qsort(iv.source, iv.n_glass, sizeof(iv.source[0]), compare_u32);
+            fprintf(stderr, " p50 %.1f p90 %.1f p99 %.1f max %.1f ms, of which source p50 %.1f p99 %.1f ms,",
+                    percentile_ms(iv.glass, iv.n_glass, 50), percentile_ms(iv.glass, iv.n_glass, 90),
+                    percentile_ms(iv.glass, iv.n_glass, 99), iv.glass[iv.n_glass - 1] / 1000.0,
+                    percentile_ms(iv.source, iv.n_glass, 50), percentile_ms(iv.source, iv.n_glass, 99));
+        }
+        fprintf(stderr, " unreadable %u", iv.unreadable);
+    }
+    fprintf(stderr, "\n       per frame cpu/wall ms:");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (iv.count[i]) {
+            fprintf(stderr, " %s %.2f/%.2f", stage_names[i], iv.cpu[i] / 1000.0 / iv.count[i],
+                    iv.wall[i] / 1000.0 / iv.count[i]);
+        }
+    }
+    fprintf(stderr, "\n");
+    return STATS_REPORT_MS;
+}
+
+void stats_write_json(struct stats *st, FILE *out) {
+    SDL_LockMutex(st->lock);
+    double seconds = (stats_now_us() - st->run_start) / 1e6;
+    struct run *run = &st->run;
+    fprintf(out, "{\"seconds\": %.3f, \"captured\": %llu, \"presented\": %llu, \"dropped\": %llu", seconds,
+            (unsigned long long)run->captured, (unsigned long long)run->presented, (unsigned long long)run->dropped);
+    fprintf(out, ", \"discarded\": %llu", (unsigned long long)run->discarded);
+    fprintf(out, ", \"capture_fps\": %.2f, \"present_fps\": %.2f", run->captured / seconds, run->presented / seconds);
+    if (run->n_latency) {
+        qsort(run->latency, run->n_latency, sizeof(run->latency[0]), compare_u32);
+        fprintf(out, ", \"latency_p50_ms\": %.3f, \"latency_p90_ms\": %.3f, \"latency_p99_ms\": %.3f",
+                percentile_ms(run->latency, run->n_latency, 50), percentile_ms(run->latency, run->n_latency, 90),
+                percentile_ms(run->latency, run->n_latency, 99));
+    }
+    if (run->n_glass) {
+        qsort(run->glass, run->n_glass, sizeof(run->glass[0]), compare_u32);
+        qsort(run->source, run->n_glass, sizeof(run->source[0]), compare_u32);
+        fprintf(out, ", \"glass_p50_ms\": %.3f, \"glass_p90_ms\": %.3f, \"glass_p99_ms\": %.3f",
+                percentile_ms(run->glass, run->n_glass, 50), percentile_ms(run->glass, run->n_glass, 90),
+                percentile_ms(run->glass, run->n_glass, 99));
+        fprintf(out, ", \"source_p50_ms\": %.3f, \"source_p99_ms\": %.3f", percentile_ms(run->source, run->n_glass, 50),
+                percentile_ms(run->source, run->n_glass, 99));
+    }
+    if (run->n_glass || run->unreadable) {
+        fprintf(out, ", \"unreadable\": %llu", (unsigned long long)run->unreadable);
+    }
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        Uint64 count = run->count[i] ? run->count[i] : 1;
+        fprintf(out, ", \"%s_ns\": %llu, \"%s_cpu_ns\": %llu", stage_names[i],
+                (unsigned long long)(run->wall[i] * 1000 / count), stage_names[i],
+                (unsigned long long)(run->cpu[i] * 1000 / count));
+    }
+    fprintf(out, "}\n");
+    SDL_UnlockMutex(st->lock);
+}
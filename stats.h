@@ -0,0 +1,69 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+
+#define STATS_REPORT_MS 1000 // Interval between reports on stderr
+#define STATS_MAX_SAMPLES 1024 // Latency samples kept per report interval
+#define STATS_RUN_SAMPLES 16384 // Latency samples kept for the whole run
+
+// Pipeline stages timed per frame
+enum stats_stage {
+    STAGE_DQBUF,   // Capture thread: dequeueing the buffer
+    STAGE_UPLOAD,  // Main thread: copying the frame into the texture
+    STAGE_RENDER,  // Main thread: clearing and drawing
+    STAGE_PRESENT, // Main thread: SDL_RenderPresent, includes waiting for the compositor
+    STAGE_COUNT
+};
+
+// Start of a timed stage, wall-clock and thread CPU time in microseconds
+struct stats_timer {
+    Uint64 wall;
+    Uint64 cpu;
+};
+
+struct stats;
+
+// Allocate statistics, collecting only while enabled. Returns NULL on failure.
+struct stats *stats_create(int enabled);
+void stats_destroy(struct stats *st);
+
+// Turn collection and reporting on or off. Counters restart when enabled.
+void stats_set_enabled(struct stats *st, int enabled);
+int stats_enabled(struct stats *st);
+
+// CLOCK_MONOTONIC in microseconds, the clock V4L2 timestamps use
+Uint64 stats_now_us(void);
+
+void stats_begin(struct stats *st, struct stats_timer *t);
+void stats_end(struct stats *st, enum stats_stage stage, const struct stats_timer *t);
+
+// A frame left the driver (capture thread). Gaps in `sequence` count as
+// frames the driver dropped.
+void stats_captured(struct stats *st, Uint32 sequence);
+
+// `count` frames were dequeued but requeued unseen because a newer one was
+// ready at the same time (capture thread)
+void stats_discarded(struct stats *st, Uint32 count);
+
+// A new frame reached the screen (main thread). `timestamp` is its V4L2
+// capture time on stats_now_us()'s clock, 0 when unknown. Captured frames
+// that never reach the screen are reported as skipped.
+void stats_presented(struct stats *st, Uint64 timestamp);
+
+// A presented frame was read back from the renderer (--g2g). `stamp` is the
+// time its source drew it, 0 when no stamp could be read; `timestamp` its
+// capture time. Glass-to-glass latency is split into source latency (stamp
+// to timestamp) and the pipeline latency that stats_presented() measures.
+void stats_stamped(struct stats *st, Uint64 stamp, Uint64 timestamp);
+
+// Print a report to stderr if STATS_REPORT_MS has passed since the last
+// one, and start a new interval. Returns milliseconds until the next report
+// is due, -1 when disabled.
+int stats_report(struct stats *st);
+
+// Write totals since stats were enabled as one JSON object line
+void stats_write_json(struct stats *st, FILE *out);
+
+#endif
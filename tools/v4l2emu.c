@@ -0,0 +1,744 @@
+// LD_PRELOAD V4L2 device emulator. Makes a fake capture device appear at
+// $V4L2EMU_DEVICE so circam's real ioctl path can run without a camera:
+//
+//   LD_PRELOAD=./v4l2emu.so ./circam --stats /dev/video99
+//
+// Configuration (environment):
+//   V4L2EMU_DEVICE       device path (default /dev/video99)
+//   V4L2EMU_FORMATS      formats, sizes and rates offered, e.g.
+//                        "YUYV:640x480@30,1280x720@10;MJPG:1280x720@30/15"
+//   V4L2EMU_LATENCY_MS   delay from a frame's timestamp until it can be dequeued
+//   V4L2EMU_DROP_EVERY   drop every Nth frame (a sequence gap, as a real driver shows)
+//   V4L2EMU_STALL_EVERY  stall after every N frames...
+//   V4L2EMU_STALL_MS     ...for this long
+//
+// The fake fd is a semaphore eventfd counting frames ready to dequeue, so
+// poll() and select() work on it unmodified; only open (with its fortified
+// variants), close, ioctl and mmap are intercepted. Buffers live in a memfd that mmap() maps for real.
+#define _GNU_SOURCE
+#include <linux/videodev2.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <jpeglib.h>
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+#define DEFAULT_DEVICE "/dev/video99"
+#define DEFAULT_FORMATS "YUYV:640x480@30,1280x720@10;MJPG:640x480@30,1280x720@30,1920x1080@30"
+#define MAX_FORMATS 4
+#define MAX_SIZES 16
+#define MAX_RATES 8
+#define MAX_BUFFERS 32
+#define JPEG_QUALITY 80
+
+struct emu_size {
+    int width, height;
+    int fps[MAX_RATES];
+    int n_fps;
+};
+
+struct emu_format {
+    uint32_t fourcc;
+    struct emu_size sizes[MAX_SIZES];
+    int n_sizes;
+};
+
+struct emu_buffer {
+    struct v4l2_buffer buf;
+    uint8_t *data;          // Our own mapping of the memfd
+    uint64_t ready;         // When a filled buffer may be dequeued, microseconds
+};
+
+struct emu {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int fd;               // eventfd handed to the application
+    int memfd;
+    struct emu_format formats[MAX_FORMATS];
+    int n_formats;
+    struct v4l2_pix_format pix;
+    struct v4l2_fract interval;
+    struct emu_buffer buffers[MAX_BUFFERS];
+    int n_buffers;
+    size_t buffer_stride; // Page-aligned buffer size inside the memfd
+    int queued[MAX_BUFFERS], n_queued;   // FIFO of buffers the application queued
+    int done[MAX_BUFFERS], n_done;       // FIFO of filled buffers
+    int streaming;
+    uint32_t sequence;
+    uint8_t *jpeg;          // Pre-encoded MJPEG frame
+    unsigned long jpeg_size;
+    uint64_t latency_us;
+    int drop_every, stall_every, stall_ms;
+};
+
+static struct emu *emu;
+static pthread_once_t emu_once = PTHREAD_ONCE_INIT;
+static const char *emu_device = DEFAULT_DEVICE;
+static int (*real_open)(const char *, int, ...);
+static int (*real_openat)(int, const char *, int, ...);
+static int (*real_close)(int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t);
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t when) {
+    struct timespec ts = { when / 1000000, when % 1000000 * 1000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static int env_int(const char *name) {
+    const char *s = getenv(name);
+    return s ? atoi(s) : 0;
+}
+
+// "YUYV:640x480@30/15,1280x720@10;MJPG:..."
+static void parse_formats(struct emu *e, const char *spec) {
+    char *copy = strdup(spec), *save_format = NULL;
+    for (char *f = strtok_r(copy, ";", &save_format); f && e->n_formats < MAX_FORMATS;
+         f = strtok_r(NULL, ";", &save_format)) {
+        char *colon = strchr(f, ':');
+        if (!colon || colon - f > 4) {
+            continue;
+        }
+        char c[4] = { ' ', ' ', ' ', ' ' };
+        memcpy(c, f, colon - f);
+        struct emu_format *fmt = &e->formats[e->n_formats];
+        CLEAR(*fmt);
+        fmt->fourcc = v4l2_fourcc(c[0], c[1], c[2], c[3]);
+        char *save_size = NULL;
+        for (char *s = strtok_r(colon + 1, ",", &save_size); s && fmt->n_sizes < MAX_SIZES;
+             s = strtok_r(NULL, ",", &save_size)) {
+            struct emu_size *size = &fmt->sizes[fmt->n_sizes];
+            CLEAR(*size);
+            char *at = strchr(s, '@');
+            if (sscanf(s, "%dx%d", &size->width, &size->height) != 2 || size->width <= 0 || size->height <= 0) {
+                continue;
+            }
+            for (char *r = at; r && size->n_fps < MAX_RATES; r = strchr(r + 1, '/')) {
+                int fps = atoi(r + 1);
+                if (fps > 0) {
+                    size->fps[size->n_fps++] = fps;
+                }
+            }
+            if (size->n_fps == 0) {
+                size->fps[size->n_fps++] = 30;
+            }
+            fmt->n_sizes++;
+        }
+        if (fmt->n_sizes) {
+            e->n_formats++;
+        }
+    }
+    free(copy);
+}
+
+static void init(void) {
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_openat = dlsym(RTLD_NEXT, "openat");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+    real_mmap = dlsym(RTLD_NEXT, "mmap");
+    if (getenv("V4L2EMU_DEVICE")) {
+        emu_device = getenv("V4L2EMU_DEVICE");
+    }
+}
+
+static const struct emu_format *find_format(const struct emu *e, uint32_t fourcc) {
+    for (int i = 0; i < e->n_formats; i++) {
+        if (e->formats[i].fourcc == fourcc) {
+            return &e->formats[i];
+        }
+    }
+    return NULL;
+}
+
+static const struct emu_size *find_size(const struct emu_format *f, int width, int height) {
+    for (int i = 0; i < f->n_sizes; i++) {
+        if (f->sizes[i].width == width && f->sizes[i].height == height) {
+            return &f->sizes[i];
+        }
+    }
+    return NULL;
+}
+
+// Snap a requested format to what is offered, like a driver's S_FMT
+static const struct emu_size *adjust_format(const struct emu *e, struct v4l2_pix_format *pix) {
+    const struct emu_format *f = find_format(e, pix->pixelformat);
+    if (!f) {
+        f = &e->formats[0];
+    }
+    const struct emu_size *size = find_size(f, pix->width, pix->height);
+    if (!size) {
+        // Closest area
+        size = &f->sizes[0];
+        long want = (long)pix->width * pix->height;
+        for (int i = 1; i < f->n_sizes; i++) {
+            if (labs((long)f->sizes[i].width * f->sizes[i].height - want) < labs((long)size->width * size->height - want)) {
+                size = &f->sizes[i];
+            }
+        }
+    }
+    uint32_t fourcc = f->fourcc;
+    CLEAR(*pix);
+    pix->pixelformat = fourcc;
+    pix->width = size->width;
+    pix->height = size->height;
+    pix->field = V4L2_FIELD_NONE;
+    pix->colorspace = fourcc == V4L2_PIX_FMT_MJPEG ? V4L2_COLORSPACE_JPEG : V4L2_COLORSPACE_SRGB;
+    if (fourcc == V4L2_PIX_FMT_NV12) {
+        pix->bytesperline = size->width;
+        pix->sizeimage = size->width * size->height * 3 / 2;
+    } else if (fourcc == V4L2_PIX_FMT_MJPEG) {
+        pix->sizeimage = size->width * size->height * 2;
+    } else {
+        pix->bytesperline = size->width * 2;
+        pix->sizeimage = size->width * size->height * 2;
+    }
+    return size;
+}
+
+// Gray ramp in packed 4:2:2 (YUYV order); other layouts are derived from it
+static void fill_yuyv(uint8_t *p, int width, int height, int pitch) {
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = p + (size_t)y * pitch;
+        for (int x = 0; x < width; x += 2) {
+            uint8_t luma = 16 + (x * 219 / width + y * 64 / height) % 220;
+            row[x * 2] = luma;
+            row[x * 2 + 1] = 64 + y * 128 / height;
+            row[x * 2 + 2] = luma;
+            row[x * 2 + 3] = 192 - x * 128 / width;
+        }
+    }
+}
+
+static void fill_buffer(const struct emu *e, uint8_t *p) {
+    const struct v4l2_pix_format *pix = &e->pix;
+    if (pix->pixelformat == V4L2_PIX_FMT_NV12) {
+        for (uint32_t y = 0; y < pix->height; y++) {
+            for (uint32_t x = 0; x < pix->width; x++) {
+                p[y * pix->bytesperline + x] = 16 + (x * 219 / pix->width + y * 64 / pix->height) % 220;
+            }
+        }
+        memset(p + pix->height * pix->bytesperline, 128, pix->height / 2 * pix->bytesperline);
+    } else if (pix->pixelformat == V4L2_PIX_FMT_MJPEG) {
+        memcpy(p, e->jpeg, e->jpeg_size);
+    } else {
+        fill_yuyv(p, pix->width, pix->height, pix->bytesperline);
+        if (pix->pixelformat == V4L2_PIX_FMT_UYVY) {
+            for (size_t i = 0; i + 1 < (size_t)pix->bytesperline * pix->height; i += 2) {
+                uint8_t t = p[i];
+                p[i] = p[i + 1];
+                p[i + 1] = t;
+            }
+        }
+    }
+}
+
+// Overlay the sequence number as 32 black and white blocks along the top
+static void stamp_counter(const struct emu *e, uint8_t *p, uint32_t sequence) {
+    const struct v4l2_pix_format *pix = &e->pix;
+    if (pix->pixelformat == V4L2_PIX_FMT_MJPEG) {
+        return;
+    }
+    int block = pix->width / 40 & ~1;
+    int bpp = pix->pixelformat == V4L2_PIX_FMT_NV12 ? 1 : 2;
+    int luma = pix->pixelformat == V4L2_PIX_FMT_UYVY ? 1 : 0;
+    for (int bit = 0; bit < 32 && block; bit++) {
+        uint8_t value = (sequence >> (31 - bit)) & 1 ? 235 : 16;
+        for (int y = block; y < 2 * block; y++) {
+            uint8_t *row = p + (size_t)y * pix->bytesperline + (size_t)(bit + 4) * block * bpp;
+            for (int x = 0; x < block; x++) {
+                row[x * bpp + (bpp == 2 ? luma : 0)] = value;
+            }
+        }
+    }
+}
+
+static int encode_jpeg(struct emu *e) {
+    const struct v4l2_pix_format *pix = &e->pix;
+    size_t pitch = pix->width * 2;
+    uint8_t *yuyv = malloc(pitch * pix->height);
+    uint8_t *row = malloc((size_t)pix->width * 3);
+    if (!yuyv || !row) {
+        free(yuyv);
+        free(row);
+        return -1;
+    }
+    fill_yuyv(yuyv, pix->width, pix->height, pitch);
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    free(e->jpeg);
+    e->jpeg = NULL;
+    e->jpeg_size = 0;
+    jpeg_mem_dest(&cinfo, &e->jpeg, &e->jpeg_size);
+    cinfo.image_width = pix->width;
+    cinfo.image_height = pix->height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, JPEG_QUALITY, TRUE);
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 1;
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const uint8_t *p = yuyv + cinfo.next_scanline * pitch;
+        for (uint32_t x = 0; x < pix->width; x += 2, p += 4) {
+            uint8_t *q = row + x * 3;
+            q[0] = p[0], q[1] = p[1], q[2] = p[3];
+            q[3] = p[2], q[4] = p[1], q[5] = p[3];
+        }
+        JSAMPROW rows[1] = { row };
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(yuyv);
+    free(row);
+    return 0;
+}
+
+// Frame clock: fills the oldest queued buffer on every tick and releases
+// filled buffers once their latency has passed
+static void *frame_thread(void *data) {
+    struct emu *e = data;
+    pthread_mutex_lock(&e->lock);
+    uint64_t period = (uint64_t)1000000 * e->interval.numerator / e->interval.denominator;
+    uint64_t next_tick = now_us() + period;
+    int pending[MAX_BUFFERS], n_pending = 0; // Filled, waiting for their latency
+    uint32_t frames = 0;
+    while (e->streaming) {
+        uint64_t wake = next_tick;
+        if (n_pending && e->buffers[pending[0]].ready < wake) {
+            wake = e->buffers[pending[0]].ready;
+        }
+        pthread_mutex_unlock(&e->lock);
+        sleep_until(wake);
+        pthread_mutex_lock(&e->lock);
+        if (!e->streaming) {
+            break;
+        }
+        uint64_t now = now_us();
+
+        if (now >= next_tick) {
+            next_tick += period;
+            uint32_t sequence = e->sequence++;
+            frames++;
+            int dropped = e->drop_every > 0 && sequence % e->drop_every == (uint32_t)e->drop_every - 1;
+            if (!dropped && e->n_queued) {
+                int index = e->queued[0];
+                memmove(e->queued, e->queued + 1, --e->n_queued * sizeof(e->queued[0]));
+                struct emu_buffer *b = &e->buffers[index];
+                stamp_counter(e, b->data, sequence);
+                b->buf.sequence = sequence;
+                b->buf.bytesused = e->pix.pixelformat == V4L2_PIX_FMT_MJPEG ? e->jpeg_size : e->pix.sizeimage;
+                b->buf.timestamp.tv_sec = now / 1000000;
+                b->buf.timestamp.tv_usec = now % 1000000;
+                b->ready = now + e->latency_us;
+                pending[n_pending++] = index;
+            }
+            if (e->stall_every > 0 && frames % e->stall_every == 0) {
+                next_tick += (uint64_t)e->stall_ms * 1000;
+            }
+        }
+
+        // Release filled buffers whose latency has passed
+        while (n_pending && e->buffers[pending[0]].ready <= now) {
+            e->done[e->n_done++] = pending[0];
+            memmove(pending, pending + 1, --n_pending * sizeof(pending[0]));
+            uint64_t one = 1;
+            if (write(e->fd, &one, sizeof(one)) < 0) {
+                perror("v4l2emu: write");
+            }
+        }
+    }
+    // Frames still in flight go back to the queue
+    for (int i = 0; i < n_pending; i++) {
+        e->queued[e->n_queued++] = pending[i];
+    }
+    pthread_mutex_unlock(&e->lock);
+    return NULL;
+}
+
+static void stream_off(struct emu *e) {
+    if (!e->streaming) {
+        return;
+    }
+    e->streaming = 0;
+    pthread_mutex_unlock(&e->lock);
+    pthread_join(e->thread, NULL);
+    pthread_mutex_lock(&e->lock);
+    // Like a driver: every buffer returns to the application, dequeued
+    uint64_t value;
+    int flags = fcntl(e->fd, F_GETFL);
+    fcntl(e->fd, F_SETFL, flags | O_NONBLOCK);
+    while (read(e->fd, &value, sizeof(value)) == sizeof(value)) {
+    }
+    fcntl(e->fd, F_SETFL, flags);
+    e->n_queued = e->n_done = 0;
+}
+
+static void free_buffers(struct emu *e) {
+    for (int i = 0; i < e->n_buffers; i++) {
+        munmap(e->buffers[i].data, e->buffer_stride);
+    }
+    if (e->memfd >= 0) {
+        real_close(e->memfd);
+        e->memfd = -1;
+    }
+    e->n_buffers = 0;
+}
+
+static int fail(int err) {
+    errno = err;
+    return -1;
+}
+
+static int emu_ioctl(struct emu *e, unsigned long request, void *arg) {
+    switch (request) {
+    case VIDIOC_QUERYCAP: {
+        struct v4l2_capability *cap = arg;
+        CLEAR(*cap);
+        snprintf((char *)cap->driver, sizeof(cap->driver), "v4l2emu");
+        snprintf((char *)cap->card, sizeof(cap->card), "circam V4L2 emulator");
+        snprintf((char *)cap->bus_info, sizeof(cap->bus_info), "platform:v4l2emu");
+        cap->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+        cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+        return 0;
+    }
+    case VIDIOC_ENUM_FMT: {
+        struct v4l2_fmtdesc *desc = arg;
+        if (desc->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || desc->index >= (uint32_t)e->n_formats) {
+            return fail(EINVAL);
+        }
+        uint32_t fourcc = e->formats[desc->index].fourcc;
+        desc->pixelformat = fourcc;
+        desc->flags = fourcc == V4L2_PIX_FMT_MJPEG ? V4L2_FMT_FLAG_COMPRESSED : 0;
+        snprintf((char *)desc->description, sizeof(desc->description), "%.4s", (char *)&fourcc);
+        return 0;
+    }
+    case VIDIOC_ENUM_FRAMESIZES: {
+        struct v4l2_frmsizeenum *size = arg;
+        const struct emu_format *f = find_format(e, size->pixel_format);
+        if (!f || size->index >= (uint32_t)f->n_sizes) {
+            return fail(EINVAL);
+        }
+        size->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+        size->discrete.width = f->sizes[size->index].width;
+        size->discrete.height = f->sizes[size->index].height;
+        return 0;
+    }
+    case VIDIOC_ENUM_FRAMEINTERVALS: {
+        struct v4l2_frmivalenum *ival = arg;
+        const struct emu_format *f = find_format(e, ival->pixel_format);
+        const struct emu_size *size = f ? find_size(f, ival->width, ival->height) : NULL;
+        if (!size || ival->index >= (uint32_t)size->n_fps) {
+            return fail(EINVAL);
+        }
+        ival->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+        ival->discrete.numerator = 1;
+        ival->discrete.denominator = size->fps[ival->index];
+        return 0;
+    }
+    case VIDIOC_G_FMT: {
+        struct v4l2_format *fmt = arg;
+        if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+            return fail(EINVAL);
+        }
+        fmt->fmt.pix = e->pix;
+        return 0;
+    }
+    case VIDIOC_TRY_FMT:
+    case VIDIOC_S_FMT: {
+        struct v4l2_format *fmt = arg;
+        if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+            return fail(EINVAL);
+        }
+        const struct emu_size *size = adjust_format(e, &fmt->fmt.pix);
+        if (request == VIDIOC_S_FMT) {
+            if (e->n_buffers) {
+                return fail(EBUSY);
+            }
+            e->pix = fmt->fmt.pix;
+            e->interval = (struct v4l2_fract){ 1, size->fps[0] };
+        }
+        return 0;
+    }
+    case VIDIOC_G_PARM:
+    case VIDIOC_S_PARM: {
+        struct v4l2_streamparm *parm = arg;
+        if (parm->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+            return fail(EINVAL);
+        }
+        if (request == VIDIOC_S_PARM && parm->parm.capture.timeperframe.numerator) {
+            // Closest offered rate for the current size
+            const struct emu_format *f = find_format(e, e->pix.pixelformat);
+            const struct emu_size *size = find_size(f, e->pix.width, e->pix.height);
+            double want = (double)parm->parm.capture.timeperframe.denominator / parm->parm.capture.timeperframe.numerator;
+            int best = size->fps[0];
+            for (int i = 1; i < size->n_fps; i++) {
+                if (abs(size->fps[i] - (int)want) < abs(best - (int)want)) {
+                    best = size->fps[i];
+                }
+            }
+            e->interval = (struct v4l2_fract){ 1, best };
+        }
+        CLEAR(parm->parm);
+        parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+        parm->parm.capture.timeperframe = e->interval;
+        parm->parm.capture.readbuffers = 0;
+        return 0;
+    }
+    case VIDIOC_REQBUFS: {
+        struct v4l2_requestbuffers *req = arg;
+        if (req->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || req->memory != V4L2_MEMORY_MMAP) {
+            return fail(EINVAL);
+        }
+        if (e->streaming) {
+            return fail(EBUSY);
+        }
+        free_buffers(e);
+        if (req->count == 0) {
+            return 0;
+        }
+        if (e->pix.pixelformat == V4L2_PIX_FMT_MJPEG && encode_jpeg(e) < 0) {
+            return fail(ENOMEM);
+        }
+        int count = req->count > MAX_BUFFERS ? MAX_BUFFERS : req->count;
+        size_t page = sysconf(_SC_PAGESIZE);
+        e->buffer_stride = (e->pix.sizeimage + page - 1) / page * page;
+        e->memfd = memfd_create("v4l2emu", MFD_CLOEXEC);
+        if (e->memfd < 0 || ftruncate(e->memfd, e->buffer_stride * count) < 0) {
+            free_buffers(e);
+            return fail(ENOMEM);
+        }
+        for (int i = 0; i < count; i++) {
+            struct emu_buffer *b = &e->buffers[i];
+            CLEAR(*b);
+            b->data = real_mmap(NULL, e->buffer_stride, PROT_READ | PROT_WRITE, MAP_SHARED, e->memfd, e->buffer_stride * i);
+            if (b->data == MAP_FAILED) {
+                free_buffers(e);
+                return fail(ENOMEM);
+            }
+            e->n_buffers = i + 1;
+            fill_buffer(e, b->data);
+            b->buf.index = i;
+            b->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            b->buf.memory = V4L2_MEMORY_MMAP;
+            b->buf.length = e->pix.sizeimage;
+            b->buf.m.offset = e->buffer_stride * i;
+            b->buf.field = V4L2_FIELD_NONE;
+            b->buf.flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+        }
+        req->count = count;
+        return 0;
+    }
+    case VIDIOC_QUERYBUF:
+    case VIDIOC_QBUF: {
+        struct v4l2_buffer *buf = arg;
+        if (buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || buf->index >= (uint32_t)e->n_buffers) {
+            return fail(EINVAL);
+        }
+        if (request == VIDIOC_QBUF) {
+            for (int i = 0; i < e->n_queued; i++) {
+                if (e->queued[i] == (int)buf->index) {
+                    return fail(EINVAL);
+                }
+            }
+            e->queued[e->n_queued++] = buf->index;
+        }
+        *buf = e->buffers[buf->index].buf;
+        return 0;
+    }
+    case VIDIOC_DQBUF: {
+        struct v4l2_buffer *buf = arg;
+        if (buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || !e->streaming) {
+            return fail(EINVAL);
+        }
+        // The eventfd counts filled buffers; reading it blocks like a
+        // driver unless the application opened the device non-blocking
+        uint64_t value;
+        pthread_mutex_unlock(&e->lock);
+        ssize_t r = read(e->fd, &value, sizeof(value));
+        pthread_mutex_lock(&e->lock);
+        if (r != sizeof(value)) {
+            return -1;
+        }
+        if (!e->n_done) {
+            return fail(EAGAIN);
+        }
+        int index = e->done[0];
+        memmove(e->done, e->done + 1, --e->n_done * sizeof(e->done[0]));
+        *buf = e->buffers[index].buf;
+        return 0;
+    }
+    case VIDIOC_STREAMON:
+        if (!e->n_buffers) {
+            return fail(EINVAL);
+        }
+        if (!e->streaming) {
+            e->streaming = 1;
+            e->sequence = 0;
+            if (pthread_create(&e->thread, NULL, frame_thread, e) != 0) {
+                e->streaming = 0;
+                return fail(ENOMEM);
+            }
+        }
+        return 0;
+    case VIDIOC_STREAMOFF:
+        stream_off(e);
+        return 0;
+    default:
+        // No cropping or controls: circam falls back to cropping in software
+        return fail(ENOTTY);
+    }
+}
+
+static int emu_open(int flags) {
+    pthread_once(&emu_once, init);
+    if (emu) {
+        return fail(EBUSY);
+    }
+    struct emu *e = calloc(1, sizeof(*e));
+    if (!e) {
+        return fail(ENOMEM);
+    }
+    const char *formats = getenv("V4L2EMU_FORMATS");
+    parse_formats(e, formats ? formats : DEFAULT_FORMATS);
+    if (!e->n_formats) {
+        fprintf(stderr, "v4l2emu: no usable formats in V4L2EMU_FORMATS\n");
+        free(e);
+        return fail(ENODEV);
+    }
+    e->fd = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC | (flags & O_NONBLOCK ? EFD_NONBLOCK : 0));
+    if (e->fd < 0) {
+        free(e);
+        return -1;
+    }
+    e->memfd = -1;
+    e->latency_us = (uint64_t)env_int("V4L2EMU_LATENCY_MS") * 1000;
+    e->drop_every = env_int("V4L2EMU_DROP_EVERY");
+    e->stall_every = env_int("V4L2EMU_STALL_EVERY");
+    e->stall_ms = env_int("V4L2EMU_STALL_MS");
+    pthread_mutex_init(&e->lock, NULL);
+    e->pix.pixelformat = e->formats[0].fourcc;
+    e->pix.width = e->formats[0].sizes[0].width;
+    e->pix.height = e->formats[0].sizes[0].height;
+    adjust_format(e, &e->pix);
+    e->interval = (struct v4l2_fract){ 1, e->formats[0].sizes[0].fps[0] };
+    emu = e;
+    return e->fd;
+}
+
+static int is_emu_path(const char *path) {
+    pthread_once(&emu_once, init);
+    return path && strcmp(path, emu_device) == 0;
+}
+
+// The mode argument is only there when the flags create a file
+static int needs_mode(int flags) {
+    return (flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE;
+}
+
+int open(const char *path, int flags, ...) {
+    pthread_once(&emu_once, init);
+    if (is_emu_path(path)) {
+        return emu_open(flags);
+    }
+    mode_t mode = 0;
+    if (needs_mode(flags)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    return real_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...) __attribute__((alias("open")));
+
+// What open() compiles to with _FORTIFY_SOURCE when the flags need no mode
+int __open_2(const char *path, int flags) {
+    return open(path, flags);
+}
+
+int __open64_2(const char *path, int flags) __attribute__((alias("__open_2")));
+
+int openat(int dirfd, const char *path, int flags, ...) {
+    pthread_once(&emu_once, init);
+    if (is_emu_path(path)) {
+        return emu_open(flags);
+    }
+    mode_t mode = 0;
+    if (needs_mode(flags)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    return real_openat(dirfd, path, flags, mode);
+}
+
+int close(int fd) {
+    pthread_once(&emu_once, init);
+    struct emu *e = emu;
+    if (e && fd == e->fd) {
+        pthread_mutex_lock(&e->lock);
+        stream_off(e);
+        free_buffers(e);
+        pthread_mutex_unlock(&e->lock);
+        free(e->jpeg);
+        emu = NULL;
+        real_close(e->fd);
+        free(e);
+        return 0;
+    }
+    return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...) {
+    pthread_once(&emu_once, init);
+    va_list ap;
+    va_start(ap, request);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+    struct emu *e = emu;
+    if (e && fd == e->fd) {
+        pthread_mutex_lock(&e->lock);
+        int r = emu_ioctl(e, request, arg);
+        int err = errno;
+        pthread_mutex_unlock(&e->lock);
+        errno = err;
+        return r;
+    }
+    return real_ioctl(fd, request, arg);
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    pthread_once(&emu_once, init);
+    struct emu *e = emu;
+    if (e && fd == e->fd) {
+        return real_mmap(addr, length, prot, flags, e->memfd, offset);
+    }
+    return real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off_t offset) __attribute__((alias("mmap")));